@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "bmpio.h"
+#include "probe.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+void FindHeader(unsigned char const *map, imageData *v) {
+    memcpy((*v).header, map, 54);
+    memcpy(&(*v).width, map + 18, sizeof(unsigned int));
+    memcpy(&(*v).height, map + 22, sizeof(unsigned int));
+}
+
+void FindPadding(imageData *v) {
+    if((*v).width % 4 != 0)
+        (*v).padding = 4 - (3 * (*v).width) % 4;
+    else
+        (*v).padding = 0;
+}
+
+// citeste tot fisierul in blocuri mari cand nu poate fi mapat (ex. pipe)
+unsigned char *ReadBlocks(int fd, size_t *size) {
+    size_t cap = 1 << 20, len = 0;
+    unsigned char *buf = malloc(cap);
+    ssize_t got;
+
+    while((got = read(fd, buf + len, cap - len)) > 0) {
+        len += got;
+        if(len == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+            PROBE_COUNT(PROBE_REALLOC, 1);
+        }
+    }
+
+    (*size) = len;
+    return buf;
+}
+
+void *Reserve(scratchBuffer *b, size_t size) {
+    if(b == NULL)
+        return malloc(size);
+    if((*b).size < size) {
+        free((*b).data);
+        (*b).data = malloc(size);
+        (*b).size = size;
+    }
+    return (*b).data;
+}
+
+void UnmapImage(bmpMap *m) {
+    if((*m).mapped)
+        munmap((*m).map, (*m).size);
+    else
+        free((*m).map);
+    (*m).map = NULL;
+}
+
+int MapImage(char *ImagePath, bmpMap *m) {
+    int fd = open(ImagePath, O_RDONLY);
+    int32_t width, height;
+    uint16_t bits;
+    struct stat st;
+    imageData v;
+
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        perror(ImagePath);
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    (*m).size = st.st_size;
+    (*m).map = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    (*m).mapped = (*m).map != MAP_FAILED;
+    if((*m).mapped)
+        madvise((*m).map, (*m).size, MADV_SEQUENTIAL);
+    else
+        (*m).map = ReadBlocks(fd, &(*m).size);
+    close(fd);
+
+    if((*m).size < 54) {
+        fprintf(stderr, "%s: not a BMP file\n", ImagePath);
+        UnmapImage(m);
+        return -1;
+    }
+
+    // doar BMP-uri de 24 de biti, cu randurile de jos in sus (inaltime pozitiva)
+    memcpy(&width, (*m).map + 18, sizeof(int32_t));
+    memcpy(&height, (*m).map + 22, sizeof(int32_t));
+    memcpy(&bits, (*m).map + 28, sizeof(uint16_t));
+    if(width <= 0 || height <= 0 || bits != 24) {
+        fprintf(stderr, "%s: not a 24-bit BMP file\n", ImagePath);
+        UnmapImage(m);
+        return -1;
+    }
+
+    FindHeader((*m).map, &v);
+    FindPadding(&v);
+    (*m).width = v.width;
+    (*m).height = v.height;
+    (*m).padding = v.padding;
+    (*m).stride = 3 * (size_t) v.width + v.padding;
+
+    // impartirea, nu produsul, ca stride * height sa nu poata depasi size_t
+    if((*m).stride > ((*m).size - 54) / (*m).height) {
+        fprintf(stderr, "%s: truncated pixel data\n", ImagePath);
+        UnmapImage(m);
+        return -1;
+    }
+    return 0;
+}
+
+// randul i (numarat de sus in jos), direct din fisier; randurile sunt stocate de jos in sus, la final
+unsigned char *MapRow(bmpMap m, unsigned int i) {
+    return m.map + m.size - (size_t) (i + 1) * m.stride;
+}
+
+// elibereaza paginile mapate deja copiate, ca incarcarea sa nu tina doua copii ale imaginii
+void ReleaseRows(bmpMap m, unsigned char *row, unsigned char **done) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    unsigned char *from = m.map + ((row - m.map) + page - 1) / page * page;
+
+    if(m.mapped && (*done) - from >= 1 << 22) {
+        madvise(from, (*done) - from, MADV_DONTNEED);
+        (*done) = from;
+    }
+}
+
+void FindPixels(bmpMap m, imageData *v) {
+    size_t rowSize = 3 * (size_t) (*v).width;
+    unsigned char *done = m.map + m.size;
+    unsigned int i;
+
+    for(i = 0; i < (*v).height; i ++) {
+        memcpy((*v).pixel + i * rowSize, MapRow(m, i), rowSize);
+        ReleaseRows(m, MapRow(m, i), &done);
+    }
+}
+
+// pixelii ajung in buffer-ul dat (sau intr-unul nou, daca pixels este NULL)
+int ReadImage(char *ImagePath, imageData *v, scratchBuffer *pixels) {
+    bmpMap m;
+    PROBE_START(start);
+
+    if(MapImage(ImagePath, &m) < 0)
+        return -1;
+    FindHeader(m.map, v);
+    FindPadding(v);
+    (*v).pixel = Reserve(pixels, 3 * (size_t) (*v).width * (*v).height);
+    FindPixels(m, v);
+
+    PROBE_COUNT(PROBE_BYTES_READ, m.size);
+    UnmapImage(&m);
+    PROBE_STOP(PROBE_READ_IMAGE, start);
+    return 0;
+}
+
+imageData LoadImage(char *ImagePath) {
+    imageData v;
+
+    if(ReadImage(ImagePath, &v, NULL) < 0)
+        exit(EXIT_FAILURE);
+    return v;
+}
+
+int WriteVector(int fd, struct iovec *iov, int count) {
+    ssize_t done;
+    int batch;
+
+    while(count > 0) {
+        batch = count < IOV_MAX ? count : IOV_MAX;
+        done = writev(fd, iov, batch);
+        if(done < 0)
+            return -1;
+
+        // sare peste vectorii scrisi complet si continua de unde a ramas o scriere partiala
+        while(count > 0 && done >= (ssize_t) (*iov).iov_len) {
+            done -= (*iov).iov_len;
+            iov ++;
+            count --;
+        }
+        if(count > 0) {
+            (*iov).iov_base = (char *) (*iov).iov_base + done;
+            (*iov).iov_len -= done;
+        }
+    }
+    return 0;
+}
+
+int WriteImage(imageData v, char *NewImagePath) {
+    static unsigned char zero[4];
+    int out = open(NewImagePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    size_t rowSize = 3 * (size_t) v.width;
+    struct iovec *iov;
+    int i, ct = 0, status;
+    PROBE_START(start);
+
+    if(out < 0) {
+        perror(NewImagePath);
+        return -1;
+    }
+
+    iov = malloc((2 * (size_t) v.height + 1) * sizeof(struct iovec));
+    iov[ct].iov_base = v.header;
+    iov[ct ++].iov_len = 54;
+    for(i = v.height - 1; i >= 0; i --) {
+        iov[ct].iov_base = v.pixel + i * rowSize;
+        iov[ct ++].iov_len = rowSize;
+        if(v.padding) {
+            iov[ct].iov_base = zero;
+            iov[ct ++].iov_len = v.padding;
+        }
+    }
+
+    status = WriteVector(out, iov, ct);
+    if(status < 0)
+        perror(NewImagePath);
+
+    free(iov);
+    if(close(out) < 0 && status == 0) {
+        perror(NewImagePath);
+        status = -1;
+    }
+    PROBE_COUNT(PROBE_BYTES_WRITTEN, status == 0 ? 54 + (rowSize + v.padding) * v.height : 0);
+    PROBE_STOP(PROBE_WRITE_IMAGE, start);
+    return status;
+}
+
+void SaveImage(imageData v, char *NewImagePath) {
+    if(WriteImage(v, NewImagePath) < 0)
+        exit(EXIT_FAILURE);
+}
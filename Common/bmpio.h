@@ -0,0 +1,45 @@
+#ifndef BMPIO_H
+#define BMPIO_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+// pixelii sunt pe randuri de sus in jos, cate 3 octeti (albastru, verde, rosu), fara padding
+typedef struct {
+    unsigned int height, width, padding;
+    unsigned char header[54];
+    unsigned char *pixel;
+} imageData;
+
+// memorie refolosita de la o imagine la alta; creste doar cand imaginea noua e mai mare
+typedef struct {
+    void *data;
+    size_t size;
+} scratchBuffer;
+
+// fisierul mapat (sau citit, cand nu se poate mapa); stride e lungimea unui rand cu padding
+typedef struct {
+    unsigned char *map;
+    size_t size, stride;
+    int mapped;
+    unsigned int height, width, padding;
+} bmpMap;
+
+// imagini BMP de 24 de biti, comune ambelor programe: functiile care intorc int dau -1 la eroare, cu mesajul deja
+// afisat; LoadImage/SaveImage opresc programul
+void FindHeader(unsigned char const *map, imageData *v);
+void FindPadding(imageData *v);
+unsigned char *ReadBlocks(int fd, size_t *size);
+void *Reserve(scratchBuffer *b, size_t size);
+int MapImage(char *ImagePath, bmpMap *m);
+unsigned char *MapRow(bmpMap m, unsigned int i);
+void UnmapImage(bmpMap *m);
+void ReleaseRows(bmpMap m, unsigned char *row, unsigned char **done);
+void FindPixels(bmpMap m, imageData *v);
+int ReadImage(char *ImagePath, imageData *v, scratchBuffer *pixels);
+imageData LoadImage(char *ImagePath);
+int WriteVector(int fd, struct iovec *iov, int count);
+int WriteImage(imageData v, char *NewImagePath);
+void SaveImage(imageData v, char *NewImagePath);
+
+#endif
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "probe.h"
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    int threads, generation, count, next, finished;
+    void (*job)(void *arg, int k);
+    void *arg;
+} threadPool;
+
+static threadPool pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+// un singur ParallelFor foloseste pool-ul odata; ceilalti apelanti asteapta aici
+static pthread_mutex_t poolSubmit = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+// setat pe firele din pool, pe apelant cat timp ruleaza bucati si prin InlineTasks: un ParallelFor imbricat ar astepta
+// dupa pool-ul pe care chiar il ocupa
+static __thread int inlineTasks;
+
+void *PoolWorker(void *unused) {
+    int seen = 0, k;
+
+    inlineTasks = 1;
+    pthread_mutex_lock(&pool.lock);
+    for(;;) {
+        while(pool.generation == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.generation;
+
+        while(pool.next < pool.count) {
+            k = pool.next ++;
+            pthread_mutex_unlock(&pool.lock);
+            pool.job(pool.arg, k);
+            pthread_mutex_lock(&pool.lock);
+            if(++ pool.finished == pool.count)
+                pthread_cond_signal(&pool.done);
+        }
+    }
+    return NULL;
+}
+
+void StartPool(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t t;
+    int i;
+#ifdef INSTRUMENT
+    static char threads[16];
+#endif
+
+    pool.threads = cpus > 1 ? (int) cpus : 1;
+    for(i = 1; i < pool.threads; i ++) {
+        if(pthread_create(&t, NULL, PoolWorker, NULL) != 0) {
+            pool.threads = i;
+            break;
+        }
+        pthread_detach(t);
+    }
+
+#ifdef INSTRUMENT
+    snprintf(threads, sizeof(threads), "%d", pool.threads);
+#endif
+    PROBE_NOTE("threads", threads);
+}
+
+int PoolThreads(void) {
+    pthread_once(&poolOnce, StartPool);
+    return pool.threads;
+}
+
+void InlineTasks(int on) {
+    inlineTasks = on;
+}
+
+void ParallelFor(int count, void (*job)(void *arg, int k), void *arg) {
+    int k;
+
+    if(count <= 1 || inlineTasks || PoolThreads() == 1) {
+        for(k = 0; k < count; k ++)
+            job(arg, k);
+        return;
+    }
+
+    pthread_mutex_lock(&poolSubmit);
+    pthread_mutex_lock(&pool.lock);
+    pool.job = job;
+    pool.arg = arg;
+    pool.count = count;
+    pool.next = pool.finished = 0;
+    pool.generation ++;
+    pthread_cond_broadcast(&pool.wake);
+
+    inlineTasks = 1;
+    while(pool.next < pool.count) {
+        k = pool.next ++;
+        pthread_mutex_unlock(&pool.lock);
+        job(arg, k);
+        pthread_mutex_lock(&pool.lock);
+        pool.finished ++;
+    }
+    inlineTasks = 0;
+    while(pool.finished < pool.count)
+        pthread_cond_wait(&pool.done, &pool.lock);
+
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&poolSubmit);
+}
@@ -0,0 +1,11 @@
+#ifndef POOL_H
+#define POOL_H
+
+// un fir pe procesor, pornite la primul apel; ParallelFor ruleaza job(arg, k) pentru k = 0..count-1 pe ele si pe
+// apelant. Un ParallelFor cerut chiar dintr-o bucata ruleaza direct pe firul ei, ca si dupa InlineTasks(1)
+int PoolThreads(void);
+// pe firul curent, ParallelFor ruleaza toate bucatile direct (pentru fire care lucreaza deja in paralel)
+void InlineTasks(int on);
+void ParallelFor(int count, void (*job)(void *arg, int k), void *arg);
+
+#endif
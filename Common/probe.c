@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "probe.h"
+
+// apeluri si nanosecunde pe timer, valoarea fiecarui contor; se aduna atomic, din orice fir. Notele sunt perechi
+// nume - valoare distincte (ex. kernelul ales), sub lock
+typedef struct {
+    uint64_t calls[PROBE_MAX], nanoseconds[PROBE_MAX], counter[PROBE_MAX];
+    char const *program, *timer[PROBE_MAX], *counterName[PROBE_MAX];
+    int timers, counters;
+    pthread_mutex_t lock;
+    char const *note[PROBE_NOTES][2];
+    int notes;
+} probeData;
+
+static probeData probe = {.program = "", .timer = {"ReadImage", "WriteImage"},
+                          .counterName = {"bytes_read", "bytes_written", "realloc_calls"},
+                          .timers = PROBE_COMMON_TIMERS, .counters = PROBE_COMMON_COUNTERS,
+                          .lock = PTHREAD_MUTEX_INITIALIZER};
+
+double Now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void ProbeTime(int timer, double start) {
+    __atomic_fetch_add(probe.calls + timer, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(probe.nanoseconds + timer, (uint64_t) ((Now() - start) * 1e9), __ATOMIC_RELAXED);
+}
+
+void ProbeCount(int counter, uint64_t n) {
+    __atomic_fetch_add(probe.counter + counter, n, __ATOMIC_RELAXED);
+}
+
+void ProbeNote(char const *name, char const *value) {
+    int i;
+
+    pthread_mutex_lock(&probe.lock);
+    for(i = 0; i < probe.notes; i ++) {
+        if(strcmp(probe.note[i][0], name) == 0 && strcmp(probe.note[i][1], value) == 0)
+            break;
+    }
+    if(i == probe.notes && probe.notes < PROBE_NOTES) {
+        probe.note[i][0] = name;
+        probe.note[i][1] = value;
+        probe.notes ++;
+    }
+    pthread_mutex_unlock(&probe.lock);
+}
+
+void StartProbes(char const *program, char const *timer[], char const *counter[]) {
+    probe.program = program;
+    for(; *timer != NULL && probe.timers < PROBE_MAX; timer ++)
+        probe.timer[probe.timers ++] = *timer;
+    for(; *counter != NULL && probe.counters < PROBE_MAX; counter ++)
+        probe.counterName[probe.counters ++] = *counter;
+    atexit(ProbeReport);
+}
+
+// peak_rss_kb (getrusage) tine locul varfului de alocare
+void ProbeReport(void) {
+    char const *path = getenv("INSTRUMENT_JSON");
+    FILE *out = path != NULL ? fopen(path, "w") : stderr;
+    struct rusage usage;
+    int i;
+
+    if(out == NULL) {
+        perror(path);
+        return;
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(out, "{\n  \"program\": \"%s\",\n  \"timers\": [\n", probe.program);
+    for(i = 0; i < probe.timers; i ++) {
+        fprintf(out, "    {\"name\": \"%s\", \"calls\": %llu, \"seconds\": %.6f}%s\n", probe.timer[i],
+                (unsigned long long) probe.calls[i], probe.nanoseconds[i] / 1e9, i == probe.timers - 1 ? "" : ",");
+    }
+    fprintf(out, "  ],\n  \"notes\": [\n");
+    for(i = 0; i < probe.notes; i ++) {
+        fprintf(out, "    {\"name\": \"%s\", \"value\": \"%s\"}%s\n", probe.note[i][0], probe.note[i][1],
+                i == probe.notes - 1 ? "" : ",");
+    }
+    fprintf(out, "  ],\n  \"counters\": {\n");
+    for(i = 0; i < probe.counters; i ++) {
+        fprintf(out, "    \"%s\": %llu,\n", probe.counterName[i], (unsigned long long) probe.counter[i]);
+    }
+    fprintf(out, "    \"peak_rss_kb\": %ld\n  }\n}\n", usage.ru_maxrss);
+
+    if(out != stderr)
+        fclose(out);
+}
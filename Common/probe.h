@@ -0,0 +1,45 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdint.h>
+
+// -DINSTRUMENT: timpi si contoare pe caile fierbinti, scrise in JSON la iesire (la stderr sau in fisierul din
+// INSTRUMENT_JSON); fara flag, macro-urile PROBE_* nu genereaza cod. Timpii din firele paralele se aduna pe fire.
+// Primele timere si contoare sunt ale codului comun; fiecare program le numeroteaza pe ale lui in continuare, de la
+// PROBE_COMMON_TIMERS / PROBE_COMMON_COUNTERS, si le da numele la PROBE_INIT (vectori terminati cu NULL)
+#define PROBE_READ_IMAGE 0
+#define PROBE_WRITE_IMAGE 1
+#define PROBE_COMMON_TIMERS 2
+
+#define PROBE_BYTES_READ 0
+#define PROBE_BYTES_WRITTEN 1
+#define PROBE_REALLOC 2
+#define PROBE_COMMON_COUNTERS 3
+
+#define PROBE_MAX 32
+#define PROBE_NOTES 16
+
+#ifdef INSTRUMENT
+#define PROBE_START(start) double start = Now()
+#define PROBE_STOP(timer, start) ProbeTime(timer, start)
+#define PROBE_COUNT(counter, n) ProbeCount(counter, n)
+#define PROBE_NOTE(name, value) ProbeNote(name, value)
+#define PROBE_INIT(program, timer, counter) StartProbes(program, timer, counter)
+#else
+#define PROBE_START(start)
+#define PROBE_STOP(timer, start)
+#define PROBE_COUNT(counter, n)
+#define PROBE_NOTE(name, value)
+#define PROBE_INIT(program, timer, counter) ((void) (timer), (void) (counter))
+#endif
+
+double Now(void);
+void ProbeTime(int timer, double start);
+void ProbeCount(int counter, uint64_t n);
+// name si value trebuie sa ramana valide pana la iesire (de obicei constante)
+void ProbeNote(char const *name, char const *value);
+// inregistreaza raportul cu atexit
+void StartProbes(char const *program, char const *timer[], char const *counter[]);
+void ProbeReport(void);
+
+#endif
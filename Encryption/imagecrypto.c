@@ -0,0 +1,1574 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <dirent.h>
+
+#include "imagecrypto.h"
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define MASK (1<<8) - 1;
+
+// cuvinte de cheie generate odata in modul cu memorie redusa
+#define BLOCK (1 << 14)
+
+// pana la 2^SCATTER_LOG pixeli destinatia incape in cache si pixelii se muta direct;
+// peste, se partitioneaza intai in cel mult MAX_BUCKETS galeti de pixeli consecutivi din destinatie
+#define SCATTER_LOG 20
+#define MAX_BUCKETS 256
+#define PREFETCH_DISTANCE 16
+
+// amestecarea paralela: elementele se impart in bucati fixe de SHUFFLE_CHUNK, independent de numarul de fire
+#define SHUFFLE_CHUNK (1 << 16)
+#define SHUFFLE_BUCKETS_MAX 256
+
+// statistici: 255 * 255 incape pe 16 biti, deci produsele se fac pe 16 biti si doar sumele se largesc
+#define WIDEN(x) __builtin_convertvector(x, wide32)
+
+typedef struct {
+    double blue, green, red;
+} pixelRGB;
+
+// antetul fisierelor din cache; dupa el urmeaza r (2n cuvinte) si p (n intregi), gata de mapat
+typedef struct {
+    char magic[4];
+    uint32_t r0;
+    uint64_t n;
+    uint32_t shuffle, reserved;
+} cacheFileHeader;
+
+typedef struct {
+    char *name;
+    off_t size;
+    time_t used;
+} cacheFile;
+
+typedef struct {
+    uint32_t r0, *r;
+    size_t start, count, segment;
+} keystreamJob;
+
+typedef struct {
+    unsigned char *out;
+    unsigned char const *in;
+    uint32_t const *r;
+    uint32_t sv;
+    size_t n, segment;
+    int segmented;
+    uint32_t r0;
+    unsigned char const *carry;
+} cipherJob;
+
+typedef struct {
+    unsigned char *out;
+    unsigned char const *v;
+    int const *p;
+    size_t n, slice, *cursor;
+    uint64_t *entry;
+    int buckets, shift;
+} permuteJob;
+
+typedef struct {
+    int *p;
+    size_t n, *offset;
+    uint32_t seed, swapSeed, *count;
+    int buckets;
+} shuffleJob;
+
+typedef uint32_t lanes32 __attribute__((vector_size(32)));
+typedef uint32_t wide32 __attribute__((vector_size(64)));
+typedef uint16_t half16 __attribute__((vector_size(32)));
+typedef int16_t short16 __attribute__((vector_size(32)));
+typedef uint8_t bytes16 __attribute__((vector_size(16)));
+
+// sumele exacte pe o banda de randuri; canalele sunt in ordinea din fisier (albastru, verde, rosu)
+typedef struct {
+    uint64_t hist[3][256];
+    uint64_t sum[3], square[3], cross[3][3], distance[2][3];
+} statsSums;
+
+typedef struct {
+    imageData v;
+    unsigned char const *w;
+    statsSums *part;
+    size_t rows;
+} statsJob;
+
+// jumpMatrix[k] este M^(2^k), unde M este pasul Xorshift32 vazut ca matrice peste GF(2), pe coloane
+static uint32_t jumpMatrix[64][32];
+static pthread_once_t jumpOnce = PTHREAD_ONCE_INIT;
+
+uint32_t Xorshift32(uint32_t state[static 1]) {
+    uint32_t x = state[0];
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state[0] = x;
+    return x;
+}
+
+void FreeScratch(cryptScratch *s) {
+    free((*s).pixel.data);
+    free((*s).spare.data);
+    free((*s).r.data);
+    free((*s).p.data);
+    free((*s).entry.data);
+    free((*s).cursor.data);
+    free((*s).stats.data);
+}
+
+uint32_t ApplyMatrix(uint32_t const m[32], uint32_t x) {
+    uint32_t y = 0;
+    int i;
+    for(i = 0; x; i ++, x >>= 1) {
+        if(x & 1)
+            y ^= m[i];
+    }
+    return y;
+}
+
+void InitialiseJump(void) {
+    uint32_t x;
+    int i, k;
+
+    // Xorshift32 este liniar, deci coloana i a lui M este imaginea bitului i
+    for(i = 0; i < 32; i ++) {
+        x = (uint32_t) 1 << i;
+        jumpMatrix[0][i] = Xorshift32(&x);
+    }
+
+    for(k = 1; k < 64; k ++) {
+        for(i = 0; i < 32; i ++) {
+            jumpMatrix[k][i] = ApplyMatrix(jumpMatrix[k - 1], jumpMatrix[k - 1][i]);
+        }
+    }
+}
+
+// starea obtinuta dupa `steps` apeluri Xorshift32 pornind din `state`, in O(log steps)
+uint32_t Xorshift32Jump(uint32_t state, uint64_t steps) {
+    int k;
+
+    pthread_once(&jumpOnce, InitialiseJump);
+    for(k = 0; steps; k ++, steps >>= 1) {
+        if(steps & 1)
+            state = ApplyMatrix(jumpMatrix[k], state);
+    }
+    return state;
+}
+
+// finalizatorul murmur3: amesteca bine bitii, bijectiv
+uint32_t Mix32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35u;
+    x ^= x >> 16;
+    return x;
+}
+
+// r[i - start] = starea dupa i pasi din r0, pentru start <= i < start + count; 8 sub-segmente avanseaza in paralel pe benzi SIMD
+void Xorshift32Segment(uint32_t r0, uint32_t *r, size_t start, size_t count) {
+    size_t lane = count / 8, i;
+    uint32_t x = Xorshift32Jump(r0, start);
+    lanes32 s;
+    int l;
+
+    for(l = 0; l < 8; l ++) {
+        s[l] = Xorshift32Jump(x, l * lane);
+    }
+
+    for(i = 0; i < lane; i ++) {
+        for(l = 0; l < 8; l ++) {
+            r[l * lane + i] = s[l];
+        }
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+    }
+
+    x = Xorshift32Jump(x, 8 * lane);
+    for(i = 8 * lane; i < count; i ++) {
+        r[i] = x;
+        Xorshift32(&x);
+    }
+}
+
+void KeystreamTask(void *arg, int k) {
+    keystreamJob *job = arg;
+    size_t start = (*job).start + k * (*job).segment;
+    size_t end = min(start + (*job).segment, (*job).start + (*job).count);
+
+    Xorshift32Segment((*job).r0, (*job).r + start, start, end - start);
+}
+
+void Xorshift32Into(uint32_t r0, uint32_t *r, size_t length) {
+    keystreamJob job = {r0, r, 0, length, 1 << 16};
+    int tasks = (length + job.segment - 1) / job.segment;
+
+    if(tasks > 4 * PoolThreads()) {
+        tasks = 4 * PoolThreads();
+        job.segment = (length + tasks - 1) / tasks;
+    }
+
+    ParallelFor(tasks, KeystreamTask, &job);
+}
+
+uint32_t *CallXorshift32(uint32_t r0, int length) {
+    uint32_t *r = malloc(length * sizeof(uint32_t));
+    Xorshift32Into(r0, r, length);
+    return r;
+}
+
+void DurstenfeldInto(int *p, uint32_t const *r, int n) {
+    int i, j = 1, k, aux;
+    for (i = 0; i < n; i ++) {
+        p[i] = i;
+    }
+
+    for (i = n - 1; i >= 1; i --, j ++) {
+        k = r[j] % (i + 1);
+        aux = p[i];
+        p[i] = p[k];
+        p[k] = aux;
+    }
+}
+
+int *DurstenfeldAlgorithm(uint32_t const *r, int n) {
+    int *p = malloc(n * sizeof(int));
+    DurstenfeldInto(p, r, n);
+    return p;
+}
+
+// galeata elementului start + i, pentru i < len, aleasa uniform din primul flux derivat din r0
+void BucketWords(shuffleJob *job, uint32_t *b, size_t start, size_t len) {
+    size_t i;
+
+    Xorshift32Segment((*job).seed, b, start + 1, len);
+    for(i = 0; i < len; i ++) {
+        b[i] = (uint64_t) b[i] * (*job).buckets >> 32;
+    }
+}
+
+void ShuffleCountTask(void *arg, int k) {
+    shuffleJob *job = arg;
+    size_t i, start = (size_t) k * SHUFFLE_CHUNK, len = min(SHUFFLE_CHUNK, (*job).n - start);
+    uint32_t *b = malloc(SHUFFLE_CHUNK * sizeof(uint32_t));
+    uint32_t *count = (*job).count + (size_t) k * (*job).buckets;
+
+    BucketWords(job, b, start, len);
+    for(i = 0; i < len; i ++) {
+        count[b[i]] ++;
+    }
+    free(b);
+}
+
+void ShuffleScatterTask(void *arg, int k) {
+    shuffleJob *job = arg;
+    size_t i, start = (size_t) k * SHUFFLE_CHUNK, len = min(SHUFFLE_CHUNK, (*job).n - start);
+    uint32_t *b = malloc(SHUFFLE_CHUNK * sizeof(uint32_t));
+    uint32_t *cursor = (*job).count + (size_t) k * (*job).buckets;
+
+    BucketWords(job, b, start, len);
+    for(i = 0; i < len; i ++) {
+        (*job).p[cursor[b[i]] ++] = start + i;
+    }
+    free(b);
+}
+
+// Durstenfeld in interiorul galetii, cu al doilea flux pornit de la pozitia galetii
+void ShuffleBucketTask(void *arg, int b) {
+    shuffleJob *job = arg;
+    int *p = (*job).p + (*job).offset[b];
+    size_t len = (*job).offset[b + 1] - (*job).offset[b], lo, count, i, j;
+    uint32_t r[BLOCK];
+    int k, aux;
+
+    for(lo = 1, i = len - 1; lo < len; lo += count) {
+        count = min(BLOCK, len - lo);
+        Xorshift32Segment((*job).swapSeed, r, (*job).offset[b] + lo, count);
+        for(j = 0; j < count; j ++, i --) {
+            k = r[j] % (i + 1);
+            aux = p[i];
+            p[i] = p[k];
+            p[k] = aux;
+        }
+    }
+}
+
+// permutare aleatoare uniforma generata in paralel: fiecare element primeste o galeata aleatoare,
+// apoi fiecare galeata se amesteca separat. Rezultatul depinde doar de r0 si n, nu si de numarul de fire
+void BucketShuffleInto(int *p, uint32_t r0, int n) {
+    shuffleJob job = {p, n};
+    size_t chunks = (n + SHUFFLE_CHUNK - 1) / SHUFFLE_CHUNK, pos = 0, c, k;
+    int b;
+
+    job.buckets = min(max(n >> 16, 1), SHUFFLE_BUCKETS_MAX);
+    job.seed = Mix32(r0 ^ 0x53485546u);
+    job.swapSeed = Mix32(r0 ^ 0x46595348u);
+    // 0 este punct fix pentru Xorshift32
+    if(job.seed == 0)
+        job.seed = 1;
+    if(job.swapSeed == 0)
+        job.swapSeed = 1;
+
+    job.count = calloc(chunks * job.buckets, sizeof(uint32_t));
+    job.offset = malloc((job.buckets + 1) * sizeof(size_t));
+    ParallelFor(chunks, ShuffleCountTask, &job);
+
+    for(b = 0; b < job.buckets; b ++) {
+        job.offset[b] = pos;
+        for(k = 0; k < chunks; k ++) {
+            c = job.count[k * job.buckets + b];
+            job.count[k * job.buckets + b] = pos;
+            pos += c;
+        }
+    }
+    job.offset[job.buckets] = pos;
+
+    ParallelFor(chunks, ShuffleScatterTask, &job);
+    ParallelFor(job.buckets, ShuffleBucketTask, &job);
+
+    free(job.count);
+    free(job.offset);
+}
+
+int *BucketShuffle(uint32_t r0, int n) {
+    int *p = malloc(n * sizeof(int));
+    BucketShuffleInto(p, r0, n);
+    return p;
+}
+
+void CallPermutation(int *p, uint32_t r0, uint32_t const *r, int n, cryptMode m) {
+    if(m.shuffle == SHUFFLE_BUCKETS)
+        BucketShuffleInto(p, r0, n);
+    else
+        DurstenfeldInto(p, r, n);
+}
+
+int *Reverse(int const *p, int n) {
+    int *pp = malloc(n * sizeof(int));
+    int i;
+    for(i = 0; i < n; i ++) {
+        pp[p[i]] = i;
+    }
+    return pp;
+}
+
+uint32_t LoadPixel(unsigned char const *v) {
+    return v[0] | v[1] << 8 | (uint32_t) v[2] << 16;
+}
+
+void StorePixel(unsigned char *v, uint32_t x) {
+    v[0] = x;
+    v[1] = x >> 8;
+    v[2] = x >> 16;
+}
+
+void ScatterTask(void *arg, int k) {
+    permuteJob *job = arg;
+    size_t i, start = k * (*job).slice, end = min(start + (*job).slice, (*job).n);
+
+    for(i = start; i < end; i ++) {
+        if(i + PREFETCH_DISTANCE < end)
+            __builtin_prefetch((*job).out + 3 * (size_t) (*job).p[i + PREFETCH_DISTANCE], 1);
+        memcpy((*job).out + 3 * (size_t) (*job).p[i], (*job).v + 3 * i, 3);
+    }
+}
+
+void GatherTask(void *arg, int k) {
+    permuteJob *job = arg;
+    size_t i, start = k * (*job).slice, end = min(start + (*job).slice, (*job).n);
+
+    for(i = start; i < end; i ++) {
+        if(i + PREFETCH_DISTANCE < end)
+            __builtin_prefetch((*job).v + 3 * (size_t) (*job).p[i + PREFETCH_DISTANCE]);
+        memcpy((*job).out + 3 * i, (*job).v + 3 * (size_t) (*job).p[i], 3);
+    }
+}
+
+void CountTask(void *arg, int k) {
+    permuteJob *job = arg;
+    size_t i, start = k * (*job).slice, end = min(start + (*job).slice, (*job).n);
+    size_t *count = (*job).cursor + (size_t) k * (*job).buckets;
+
+    for(i = start; i < end; i ++) {
+        count[(*job).p[i] >> (*job).shift] ++;
+    }
+}
+
+// pixelul impachetat pe 32 de biti si pozitia lui in galeata, intr-o singura intrare de 64 de biti;
+// intrarile se strang cate o linie de cache per galeata si se scriu impreuna, ca sa nu rateze TLB-ul la fiecare scriere
+void PartitionTask(void *arg, int k) {
+    permuteJob *job = arg;
+    size_t i, start = k * (*job).slice, end = min(start + (*job).slice, (*job).n);
+    size_t *cursor = (*job).cursor + (size_t) k * (*job).buckets;
+    uint64_t line[8 * MAX_BUCKETS] __attribute__((aligned(64)));
+    unsigned char fill[MAX_BUCKETS] = {0};
+    uint32_t d, b, mask = ((uint32_t) 1 << (*job).shift) - 1;
+
+    for(i = start; i < end; i ++) {
+        d = (*job).p[i];
+        b = d >> (*job).shift;
+        line[8 * b + fill[b] ++] = (uint64_t) (d & mask) << 32 | LoadPixel((*job).v + 3 * i);
+        if(fill[b] == 8) {
+            memcpy((*job).entry + cursor[b], line + 8 * b, 64);
+            cursor[b] += 8;
+            fill[b] = 0;
+        }
+    }
+
+    for(b = 0; b < (*job).buckets; b ++) {
+        memcpy((*job).entry + cursor[b], line + 8 * b, fill[b] * sizeof(uint64_t));
+    }
+}
+
+void PlaceTask(void *arg, int b) {
+    permuteJob *job = arg;
+    size_t i, start = (size_t) b << (*job).shift, end = min(start + ((size_t) 1 << (*job).shift), (*job).n);
+    unsigned char *out = (*job).out + 3 * start;
+
+    for(i = start; i < end; i ++) {
+        StorePixel(out + 3 * ((*job).entry[i] >> 32), (uint32_t) (*job).entry[i]);
+    }
+}
+
+// galeata b primeste exact pixelii cu p[i] in [b * 2^shift, (b + 1) * 2^shift), deci ocupa exact acel interval
+// intrarile intermediare si cursoarele vin din s, daca exista, altfel se aloca aici
+void PermuteBuckets(permuteJob *job, int tasks, cryptScratch *s) {
+    size_t base, count;
+    int b, k;
+
+    for((*job).shift = SCATTER_LOG - 2; ((*job).n >> (*job).shift) >= MAX_BUCKETS; (*job).shift ++);
+    (*job).buckets = ((*job).n >> (*job).shift) + 1;
+    (*job).cursor = Reserve(s != NULL ? &(*s).cursor : NULL, (size_t) tasks * (*job).buckets * sizeof(size_t));
+    (*job).entry = Reserve(s != NULL ? &(*s).entry : NULL, (*job).n * sizeof(uint64_t));
+    memset((*job).cursor, 0, (size_t) tasks * (*job).buckets * sizeof(size_t));
+
+    ParallelFor(tasks, CountTask, job);
+    for(b = 0; b < (*job).buckets; b ++) {
+        base = (size_t) b << (*job).shift;
+        for(k = 0; k < tasks; k ++) {
+            count = (*job).cursor[(size_t) k * (*job).buckets + b];
+            (*job).cursor[(size_t) k * (*job).buckets + b] = base;
+            base += count;
+        }
+    }
+
+    ParallelFor(tasks, PartitionTask, job);
+    ParallelFor((*job).buckets, PlaceTask, job);
+
+    if(s == NULL) {
+        free((*job).cursor);
+        free((*job).entry);
+    }
+}
+
+// out[p[i]] = v[i]; s poate fi NULL
+void PermuteInto(unsigned char *out, unsigned char const *v, int const *p, int n, cryptScratch *s) {
+    permuteJob job = {out, v, p, n, n};
+    int tasks = PoolThreads();
+
+    if(n <= 1 << SCATTER_LOG) {
+        ScatterTask(&job, 0);
+    } else {
+        job.slice = (n + tasks - 1) / tasks;
+        PermuteBuckets(&job, tasks, s);
+    }
+}
+
+unsigned char *Permute(unsigned char const *v, int const *p, int n) {
+    unsigned char *pp = malloc(3 * n * sizeof(char));
+    PermuteInto(pp, v, p, n, NULL);
+    return pp;
+}
+
+// out[i] = v[p[i]], adica Permute(v, Reverse(p, n), n) fara a construi inversa;
+// adresele citite se cunosc dinainte, asa ca prefetch-ul ascunde ratarile din cache
+void GatherInto(unsigned char *out, unsigned char const *v, int const *p, int n) {
+    permuteJob job = {out, v, p, n, 1 << 16};
+
+    ParallelFor((n + job.slice - 1) / job.slice, GatherTask, &job);
+}
+
+unsigned char *Gather(unsigned char const *v, int const *p, int n) {
+    unsigned char *pp = malloc(3 * n * sizeof(char));
+    GatherInto(pp, v, p, n);
+    return pp;
+}
+
+void InitialiseSV(pixelRGB *x, unsigned int sv) {
+    (*x).blue = sv & MASK;
+    sv >>= 8;
+    (*x).green = sv & MASK;
+    sv >>= 8;
+    (*x).red = sv & MASK;
+}
+
+void XorPixels(unsigned char **v, unsigned char const *p, uint32_t const *r, pixelRGB x, int poz, int n) {
+    uint32_t rn = r[n];
+    (*v)[poz] = (unsigned char) x.blue ^ p[poz] ^ (unsigned char) rn;
+    rn >>= 8;
+    (*v)[poz + 1] = (unsigned char) x.green ^ p[poz + 1] ^ (unsigned char) rn;
+    rn >>= 8;
+    (*v)[poz + 2] = (unsigned char) x.red ^ p[poz + 2] ^ (unsigned char) rn;
+}
+
+// out = a ^ b ^ cheie pentru count pixeli; cheia pixelului i sunt cei 3 octeti mici din r[i].
+// 4 pixeli (12 octeti) se combina ca 3 cuvinte de 32 de biti, fara acces octet cu octet
+void XorKeystream(unsigned char *out, unsigned char const *a, unsigned char const *b, uint32_t const *r, size_t count) {
+    uint32_t x[3], y[3], k[3];
+    size_t i, j;
+
+    for(i = 0; i + 4 <= count; i += 4, out += 12, a += 12, b += 12, r += 4) {
+        k[0] = (r[0] & 0xFFFFFF) | r[1] << 24;
+        k[1] = (r[1] >> 8 & 0xFFFF) | r[2] << 16;
+        k[2] = (r[2] >> 16 & 0xFF) | r[3] << 8;
+
+        memcpy(x, a, 12);
+        memcpy(y, b, 12);
+        for(j = 0; j < 3; j ++) {
+            x[j] ^= y[j] ^ k[j];
+        }
+        memcpy(out, x, 12);
+    }
+
+    for(; i < count; i ++, out += 3, a += 3, b += 3, r ++) {
+        out[0] = a[0] ^ b[0] ^ (unsigned char) r[0];
+        out[1] = a[1] ^ b[1] ^ (unsigned char) (r[0] >> 8);
+        out[2] = a[2] ^ b[2] ^ (unsigned char) (r[0] >> 16);
+    }
+}
+
+// out = a ^ cheie, aceeasi impachetare ca in XorKeystream
+void MaskKeystream(unsigned char *out, unsigned char const *a, uint32_t const *r, size_t count) {
+    uint32_t x[3], k[3];
+    size_t i, j;
+
+    for(i = 0; i + 4 <= count; i += 4, out += 12, a += 12, r += 4) {
+        k[0] = (r[0] & 0xFFFFFF) | r[1] << 24;
+        k[1] = (r[1] >> 8 & 0xFFFF) | r[2] << 16;
+        k[2] = (r[2] >> 16 & 0xFF) | r[3] << 8;
+
+        memcpy(x, a, 12);
+        for(j = 0; j < 3; j ++) {
+            x[j] ^= k[j];
+        }
+        memcpy(out, x, 12);
+    }
+
+    for(; i < count; i ++, out += 3, a += 3, r ++) {
+        out[0] = a[0] ^ (unsigned char) r[0];
+        out[1] = a[1] ^ (unsigned char) (r[0] >> 8);
+        out[2] = a[2] ^ (unsigned char) (r[0] >> 16);
+    }
+}
+
+// lantul de criptare pe count pixeli: primul primeste iv, fiecare urmator pixelul criptat dinaintea lui (v[i] ^= v[i - 1],
+// pe cate 3 octeti). Cate 8 pixeli (24 de octeti, 3 cuvinte de 64 de biti) se fac deodata: iv, sau ultimul pixel al
+// grupului anterior, intra in primul pixel, apoi prefixul XOR pe grup se face in 3 pasi, cu deplasari de 1, 2 si
+// 4 pixeli peste cei 192 de biti
+void ChainPixels(unsigned char *v, unsigned char const iv[3], size_t count) {
+    uint64_t x[3], carry = iv[0] | iv[1] << 8 | (uint64_t) iv[2] << 16;
+    size_t i;
+
+    for(i = 0; i + 8 <= count; i += 8, v += 24) {
+        memcpy(x, v, 24);
+        x[0] ^= carry;
+        x[2] ^= x[2] << 24 | x[1] >> 40;
+        x[1] ^= x[1] << 24 | x[0] >> 40;
+        x[0] ^= x[0] << 24;
+        x[2] ^= x[2] << 48 | x[1] >> 16;
+        x[1] ^= x[1] << 48 | x[0] >> 16;
+        x[0] ^= x[0] << 48;
+        x[2] ^= x[1] << 32 | x[0] >> 32;
+        x[1] ^= x[0] << 32;
+        memcpy(v, x, 24);
+        carry = x[2] >> 40;
+    }
+
+    for(; i < count; i ++, v += 3) {
+        v[0] ^= carry;
+        v[1] ^= carry >> 8;
+        v[2] ^= carry >> 16;
+        carry = v[0] | v[1] << 8 | (uint64_t) v[2] << 16;
+    }
+}
+
+// IV-ul segmentului k, derivat din sv cu finalizatorul murmur3
+uint32_t SegmentIV(uint32_t sv, uint32_t k) {
+    return Mix32(sv ^ k * 0x9E3779B9u);
+}
+
+void SetIV(unsigned char iv[3], uint32_t x) {
+    iv[0] = x;
+    iv[1] = x >> 8;
+    iv[2] = x >> 16;
+}
+
+int ReadMode(imageData v, cryptMode *m) {
+    cryptMode x = {CIPHER_LEGACY, 0, SHUFFLE_DURSTENFELD};
+
+    if(v.header[6] == FORMAT_TAG) {
+        x.cipher = v.header[7];
+        x.segmentLog = v.header[8];
+        x.shuffle = v.header[9];
+    }
+
+    if(x.cipher > CIPHER_SEGMENTED || (x.cipher == CIPHER_SEGMENTED && (x.segmentLog < 4 || x.segmentLog > 30)) || x.shuffle > SHUFFLE_BUCKETS) {
+        fprintf(stderr, "unknown encryption mode %u/%u/%u\n", x.cipher, x.segmentLog, x.shuffle);
+        return -1;
+    }
+    (*m) = x;
+    return 0;
+}
+
+// modul vechi lasa header-ul neschimbat, ca fisierele criptate sa ramana identice
+void WriteMode(imageData *v, cryptMode m) {
+    if(m.cipher == CIPHER_LEGACY && m.shuffle == SHUFFLE_DURSTENFELD)
+        return;
+
+    (*v).header[6] = FORMAT_TAG;
+    (*v).header[7] = m.cipher;
+    (*v).header[8] = m.segmentLog;
+    (*v).header[9] = m.shuffle;
+}
+
+void ClearMode(imageData *v) {
+    if((*v).header[6] == FORMAT_TAG)
+        memset((*v).header + 6, 0, 4);
+}
+
+void CipheredImage(unsigned char *v, uint32_t sv, unsigned char const *p, uint32_t const *r, int n) {
+    int i, poz = 0;
+    pixelRGB x;
+
+    InitialiseSV(&x, sv);
+    XorPixels(&v, p, r, x, poz, n);
+
+    for(i = 1; i < n; i ++) {
+        x.blue = v[poz];
+        x.green = v[poz + 1];
+        x.red = v[poz + 2];
+
+        poz += 3;
+        XorPixels(&v, p, r, x, poz, n + i);
+    }
+}
+
+void EncipherTask(void *arg, int k) {
+    cipherJob *job = arg;
+    size_t start = k * (*job).segment;
+    size_t end = min(start + (*job).segment, (*job).n);
+    unsigned char *v = (*job).out;
+    unsigned char iv[3];
+
+    MaskKeystream(v + 3 * start, (*job).in + 3 * start, (*job).r + start, end - start);
+    SetIV(iv, SegmentIV((*job).sv, k));
+    ChainPixels(v + 3 * start, iv, end - start);
+}
+
+// lantul porneste din nou la fiecare segment de 2^segmentLog pixeli, cu IV propriu
+void CipheredSegments(unsigned char *v, uint32_t sv, unsigned char const *p, uint32_t const *r, int n, int segmentLog) {
+    cipherJob job = {v, p, r + n, sv, n, (size_t) 1 << segmentLog, 1};
+
+    ParallelFor((n + job.segment - 1) / job.segment, EncipherTask, &job);
+}
+
+void DecipherTask(void *arg, int k) {
+    cipherJob *job = arg;
+    size_t start = k * (*job).segment;
+    size_t end = min(start + (*job).segment, (*job).n);
+    unsigned char iv[3];
+
+    if(start == 0 || (*job).segmented) {
+        SetIV(iv, (*job).segmented ? SegmentIV((*job).sv, k) : (*job).sv);
+        XorKeystream((*job).out + 3 * start, (*job).in + 3 * start, iv, (*job).r + start, 1);
+        start ++;
+    }
+
+    XorKeystream((*job).out + 3 * start, (*job).in + 3 * start, (*job).in + 3 * (start - 1), (*job).r + start, end - start);
+}
+
+// fiecare pixel depinde doar de pixelul criptat anterior, deci bucatile se decripteaza independent
+void DecipheredImage(unsigned char *v, uint32_t sv, unsigned char const *p, uint32_t const *r, int n, cryptMode m) {
+    int segmented = m.cipher == CIPHER_SEGMENTED;
+    cipherJob job = {v, p, r + n, sv, n, (size_t) 1 << (segmented ? m.segmentLog : 16), segmented};
+    int tasks = (n + job.segment - 1) / job.segment;
+
+    // in modul segmentat bucatile trebuie sa coincida cu segmentele
+    if(!segmented && tasks > 4 * PoolThreads()) {
+        tasks = 4 * PoolThreads();
+        job.segment = (n + tasks - 1) / tasks;
+    }
+
+    ParallelFor(tasks, DecipherTask, &job);
+}
+
+void DropEntry(cacheEntry *e) {
+    if((*e).map != NULL)
+        munmap((*e).map, sizeof(cacheFileHeader) + (*e).bytes);
+    else
+        free((*e).r);
+    free((*e).p);
+    free(e);
+}
+
+// intrarile trebuie sa nu mai fie folosite de niciun context
+void FreeCache(keyCache *k) {
+    cacheEntry *e, *next;
+
+    for(e = (*k).head; e != NULL; e = next) {
+        next = (*e).next;
+        DropEntry(e);
+    }
+    pthread_mutex_destroy(&(*k).lock);
+    free((*k).directory);
+    memset(k, 0, sizeof(keyCache));
+}
+
+void UnlinkEntry(keyCache *k, cacheEntry *e) {
+    if((*e).prev != NULL)
+        (*(*e).prev).next = (*e).next;
+    else
+        (*k).head = (*e).next;
+    if((*e).next != NULL)
+        (*(*e).next).prev = (*e).prev;
+    else
+        (*k).tail = (*e).prev;
+    (*e).prev = (*e).next = NULL;
+}
+
+void PushEntry(keyCache *k, cacheEntry *e) {
+    (*e).prev = NULL;
+    (*e).next = (*k).head;
+    if((*k).head != NULL)
+        (*(*k).head).prev = e;
+    else
+        (*k).tail = e;
+    (*k).head = e;
+}
+
+cacheEntry *FindEntry(keyCache *k, uint32_t r0, size_t n, unsigned char shuffle) {
+    cacheEntry *e;
+
+    for(e = (*k).head; e != NULL; e = (*e).next) {
+        if((*e).r0 == r0 && (*e).n == n && (*e).shuffle == shuffle)
+            return e;
+    }
+    return NULL;
+}
+
+void CachePath(keyCache *k, uint32_t r0, size_t n, unsigned char shuffle, char *path, size_t size) {
+    snprintf(path, size, "%s/%08x-%zu-%u.key", (*k).directory, r0, n, shuffle);
+}
+
+int CompareFiles(void const *a, void const *b) {
+    time_t x = (*(cacheFile const *) a).used, y = (*(cacheFile const *) b).used;
+    return (x > y) - (x < y);
+}
+
+// sterge cele mai vechi fisiere (dupa ultima folosire) pana cand directorul incape in diskLimit
+void TrimDisk(keyCache *k) {
+    DIR *dir = opendir((*k).directory);
+    struct dirent *d;
+    struct stat st;
+    cacheFile *file = NULL;
+    char path[PATH_MAX];
+    size_t len, count = 0, cap = 0, i;
+    off_t total = 0;
+
+    if(dir == NULL)
+        return;
+    while((d = readdir(dir)) != NULL) {
+        len = strlen((*d).d_name);
+        if(len < 4 || strcmp((*d).d_name + len - 4, ".key") != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", (*k).directory, (*d).d_name);
+        if(stat(path, &st) < 0)
+            continue;
+        if(count == cap) {
+            cap = 2 * cap + 16;
+            file = realloc(file, cap * sizeof(cacheFile));
+            PROBE_COUNT(PROBE_REALLOC, 1);
+        }
+        file[count].name = strdup(path);
+        file[count].size = st.st_size;
+        file[count ++].used = st.st_mtime;
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    qsort(file, count, sizeof(cacheFile), CompareFiles);
+    for(i = 0; i < count; i ++) {
+        if((size_t) total > (*k).diskLimit && unlink(file[i].name) == 0)
+            total -= file[i].size;
+        free(file[i].name);
+    }
+    free(file);
+}
+
+void InitialiseCache(keyCache *k, size_t limit, char *directory, size_t diskLimit) {
+    memset(k, 0, sizeof(keyCache));
+    pthread_mutex_init(&(*k).lock, NULL);
+    (*k).limit = limit;
+    (*k).diskLimit = diskLimit;
+    if(directory != NULL) {
+        (*k).directory = strdup(directory);
+        mkdir(directory, 0755);
+        TrimDisk(k);
+    }
+}
+
+// copia lui p din fisier, daca e o permutare a lui 0..n-1 (altfel NULL): indicii ei scriu direct in imagine, deci un
+// fisier trunchiat sau modificat nu trebuie crezut. Copia nu se mai schimba dupa verificare, chiar daca fisierul da
+int *CheckPermutation(int const *from, size_t n) {
+    unsigned char *seen = calloc(n, 1);
+    int *p = malloc(n * sizeof(int));
+    size_t i;
+
+    memcpy(p, from, n * sizeof(int));
+    for(i = 0; i < n; i ++) {
+        if(p[i] < 0 || (size_t) p[i] >= n || seen[p[i]]) {
+            free(seen);
+            free(p);
+            return NULL;
+        }
+        seen[p[i]] = 1;
+    }
+
+    free(seen);
+    return p;
+}
+
+// intrarea de pe disc: r ramane mapat (privat), iar p se copiaza si se verifica; folosirea ei ii actualizeaza data
+// pentru TrimDisk
+cacheEntry *MapEntry(keyCache *k, uint32_t r0, size_t n, unsigned char shuffle) {
+    size_t bytes = 3 * n * sizeof(uint32_t);
+    char path[PATH_MAX];
+    cacheFileHeader *h;
+    cacheEntry *e;
+    struct stat st;
+    void *map;
+    int fd, *p;
+
+    CachePath(k, r0, n, shuffle, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    if(fstat(fd, &st) < 0 || (size_t) st.st_size != sizeof(cacheFileHeader) + bytes) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    futimens(fd, NULL);
+    close(fd);
+    if(map == MAP_FAILED)
+        return NULL;
+
+    h = map;
+    if(memcmp((*h).magic, "XKEY", 4) != 0 || (*h).r0 != r0 || (*h).n != n || (*h).shuffle != shuffle ||
+       (p = CheckPermutation((int *) ((uint32_t *) (h + 1) + 2 * n), n)) == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    e = calloc(1, sizeof(cacheEntry));
+    (*e).map = map;
+    (*e).r = (uint32_t *) (h + 1);
+    (*e).p = p;
+    return e;
+}
+
+// scrie intr-un fisier temporar si il redenumeste, ca alte procese sa nu vada niciodata un fisier partial
+void StoreEntry(keyCache *k, cacheEntry *e) {
+    cacheFileHeader h = {{'X', 'K', 'E', 'Y'}, (*e).r0, (*e).n, (*e).shuffle, 0};
+    char path[PATH_MAX], temp[PATH_MAX + 8];
+    struct iovec iov[3] = {{&h, sizeof(h)}, {(*e).r, 2 * (*e).n * sizeof(uint32_t)}, {(*e).p, (*e).n * sizeof(int)}};
+    int fd;
+
+    CachePath(k, (*e).r0, (*e).n, (*e).shuffle, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+    fd = mkstemp(temp);
+    if(fd < 0)
+        return;
+    if(WriteVector(fd, iov, 3) < 0 || close(fd) < 0 || rename(temp, path) < 0) {
+        unlink(temp);
+        return;
+    }
+    TrimDisk(k);
+}
+
+// intoarce intrarea pentru (r0, n, shuffle), marcata ca folosita; se cauta in memorie, apoi pe disc,
+// iar altfel se genereaza in afara lacatului, ca firele cu alte chei sa nu astepte
+cacheEntry *AcquireEntry(keyCache *k, uint32_t r0, size_t n, unsigned char shuffle) {
+    cryptMode m = {CIPHER_LEGACY, 0, shuffle};
+    cacheEntry *e, *found, *old;
+    int fromDisk;
+
+    pthread_mutex_lock(&(*k).lock);
+    e = FindEntry(k, r0, n, shuffle);
+    if(e != NULL) {
+        (*k).hits ++;
+        (*e).users ++;
+        UnlinkEntry(k, e);
+        PushEntry(k, e);
+        pthread_mutex_unlock(&(*k).lock);
+        return e;
+    }
+    pthread_mutex_unlock(&(*k).lock);
+
+    e = (*k).directory != NULL ? MapEntry(k, r0, n, shuffle) : NULL;
+    fromDisk = e != NULL;
+    if(!fromDisk) {
+        e = calloc(1, sizeof(cacheEntry));
+        (*e).r = malloc(2 * n * sizeof(uint32_t));
+        (*e).p = malloc(n * sizeof(int));
+        Xorshift32Into(r0, (*e).r, 2 * n);
+        CallPermutation((*e).p, r0, (*e).r, n, m);
+    }
+    (*e).r0 = r0;
+    (*e).n = n;
+    (*e).shuffle = shuffle;
+    (*e).bytes = 3 * n * sizeof(uint32_t);
+    if(!fromDisk && (*k).directory != NULL)
+        StoreEntry(k, e);
+
+    pthread_mutex_lock(&(*k).lock);
+    // alt fir poate sa fi adus aceeasi intrare intre timp
+    found = FindEntry(k, r0, n, shuffle);
+    if(found != NULL) {
+        (*k).hits ++;
+        DropEntry(e);
+        e = found;
+        UnlinkEntry(k, e);
+    } else {
+        if(fromDisk)
+            (*k).diskHits ++;
+        else
+            (*k).misses ++;
+        for(old = (*k).tail; old != NULL && (*e).bytes <= (*k).limit && (*k).bytes + (*e).bytes > (*k).limit; old = found) {
+            found = (*old).prev;
+            if((*old).users == 0) {
+                UnlinkEntry(k, old);
+                (*k).bytes -= (*old).bytes;
+                (*k).evictions ++;
+                DropEntry(old);
+            }
+        }
+        // nu incape nici dupa eliberare: o foloseste doar apelantul si dispare la ReleaseEntry
+        if((*k).bytes + (*e).bytes > (*k).limit)
+            (*e).detached = 1;
+        else
+            (*k).bytes += (*e).bytes;
+    }
+    (*e).users ++;
+    if(!(*e).detached)
+        PushEntry(k, e);
+    pthread_mutex_unlock(&(*k).lock);
+    return e;
+}
+
+void ReleaseEntry(keyCache *k, cacheEntry *e) {
+    pthread_mutex_lock(&(*k).lock);
+    if(-- (*e).users == 0 && (*e).detached)
+        DropEntry(e);
+    pthread_mutex_unlock(&(*k).lock);
+}
+
+void InitialiseContext(cryptContext *c, uint32_t r0, uint32_t sv, cryptMode m) {
+    memset(c, 0, sizeof(cryptContext));
+    (*c).r0 = r0;
+    (*c).sv = sv;
+    (*c).m = m;
+}
+
+void SetKey(cryptContext *c, uint32_t r0, uint32_t sv) {
+    if((*c).r0 != r0)
+        (*c).n = 0;
+    (*c).r0 = r0;
+    (*c).sv = sv;
+}
+
+// contextul ia r si p din k in loc sa le pastreze singur; k trebuie sa traiasca mai mult decat contextul
+void UseCache(cryptContext *c, keyCache *k) {
+    if((*c).entry != NULL)
+        ReleaseEntry((*c).cache, (*c).entry);
+    (*c).cache = k;
+    (*c).entry = NULL;
+    (*c).n = 0;
+}
+
+void FreeContext(cryptContext *c) {
+    if((*c).entry != NULL)
+        ReleaseEntry((*c).cache, (*c).entry);
+    FreeScratch(&(*c).scratch);
+    memset(c, 0, sizeof(cryptContext));
+}
+
+// cheia r si permutarea p pentru n pixeli; se refac doar cand s-a schimbat r0, n sau amestecarea
+void PrepareKey(cryptContext *c, size_t n) {
+    uint32_t *r;
+    int *p;
+
+    if((*c).n == n && (*c).shuffle == (*c).m.shuffle)
+        return;
+
+    if((*c).cache != NULL) {
+        if((*c).entry != NULL)
+            ReleaseEntry((*c).cache, (*c).entry);
+        (*c).entry = AcquireEntry((*c).cache, (*c).r0, n, (*c).m.shuffle);
+        r = (*(*c).entry).r;
+        p = (*(*c).entry).p;
+    } else {
+        r = Reserve(&(*c).scratch.r, 2 * n * sizeof(uint32_t));
+        p = Reserve(&(*c).scratch.p, n * sizeof(int));
+        Xorshift32Into((*c).r0, r, 2 * n);
+        CallPermutation(p, (*c).r0, r, n, (*c).m);
+    }
+    (*c).r = r;
+    (*c).p = p;
+    (*c).n = n;
+    (*c).shuffle = (*c).m.shuffle;
+}
+
+// cripteaza pe loc n pixeli BGR din memoria apelantului; dupa primul apel de aceeasi dimensiune nu mai aloca nimic
+void EncryptBuffer(cryptContext *c, unsigned char *pixel, size_t n) {
+    cryptScratch *s = &(*c).scratch;
+    unsigned char *pp = Reserve(&(*s).spare, 3 * n);
+
+    PrepareKey(c, n);
+    PermuteInto(pp, pixel, (*c).p, n, s);
+    if((*c).m.cipher == CIPHER_SEGMENTED)
+        CipheredSegments(pixel, (*c).sv, pp, (*c).r, n, (*c).m.segmentLog);
+    else
+        CipheredImage(pixel, (*c).sv, pp, (*c).r, n);
+}
+
+// modul trebuie sa fie cel de la criptare ((*c).m)
+void DecryptBuffer(cryptContext *c, unsigned char *pixel, size_t n) {
+    cryptScratch *s = &(*c).scratch;
+    unsigned char *w = Reserve(&(*s).spare, 3 * n);
+
+    PrepareKey(c, n);
+    DecipheredImage(w, (*c).sv, pixel, (*c).r, n, (*c).m);
+    GatherInto(pixel, w, (*c).p, n);
+}
+
+void Encrypt(imageData *v, cryptContext *c) {
+    PROBE_START(start);
+
+    EncryptBuffer(c, (*v).pixel, (size_t) (*v).width * (*v).height);
+    WriteMode(v, (*c).m);
+    PROBE_STOP(PROBE_ENCRYPT, start);
+}
+
+// modul se citeste din header si ramane in context; cu un mod necunoscut imaginea ramane neschimbata
+int Decrypt(imageData *v, cryptContext *c) {
+    PROBE_START(start);
+
+    if(ReadMode(*v, &(*c).m) < 0)
+        return -1;
+    DecryptBuffer(c, (*v).pixel, (size_t) (*v).width * (*v).height);
+    ClearMode(v);
+    PROBE_STOP(PROBE_DECRYPT, start);
+    return 0;
+}
+
+void SwapPixels(unsigned char *v, size_t a, size_t b) {
+    unsigned char aux[3];
+    memcpy(aux, v + 3 * a, 3);
+    memcpy(v + 3 * a, v + 3 * b, 3);
+    memcpy(v + 3 * b, aux, 3);
+}
+
+// acelasi rezultat ca Permute(v, DurstenfeldAlgorithm(r, n), n), fara vectorul p: interschimbarile
+// algoritmului se refac direct pe pixeli, in ordine inversa (i = 1..n-1 foloseste r[n - i])
+void PermuteInPlace(unsigned char *v, uint32_t r0, size_t n) {
+    uint32_t r[BLOCK];
+    size_t hi, len, j, i;
+
+    for(hi = n; hi > 1; hi -= len) {
+        len = min(BLOCK, hi - 1);
+        Xorshift32Segment(r0, r, hi - len, len);
+        for(j = len; j -- > 0;) {
+            i = n - (hi - len + j);
+            SwapPixels(v, i, r[j] % (i + 1));
+        }
+    }
+}
+
+// acelasi rezultat ca Permute(v, Reverse(p, n), n): interschimbarile in ordinea din DurstenfeldAlgorithm
+void ReverseInPlace(unsigned char *v, uint32_t r0, size_t n) {
+    uint32_t r[BLOCK];
+    size_t lo, len, j, i;
+
+    for(lo = 1; lo < n; lo += len) {
+        len = min(BLOCK, n - lo);
+        Xorshift32Segment(r0, r, lo, len);
+        for(j = 0; j < len; j ++) {
+            i = n - (lo + j);
+            SwapPixels(v, i, r[j] % (i + 1));
+        }
+    }
+}
+
+void EncipherInPlaceTask(void *arg, int k) {
+    cipherJob *job = arg;
+    size_t start = k * (*job).segment;
+    size_t end = min(start + (*job).segment, (*job).n);
+    unsigned char *v = (*job).out, prev[3];
+    uint32_t r[BLOCK];
+    size_t lo, len;
+
+    SetIV(prev, (*job).segmented ? SegmentIV((*job).sv, k) : (*job).sv);
+    for(lo = start; lo < end; lo += len) {
+        len = min(BLOCK, end - lo);
+        Xorshift32Segment((*job).r0, r, (*job).n + lo, len);
+        MaskKeystream(v + 3 * lo, v + 3 * lo, r, len);
+        ChainPixels(v + 3 * lo, prev, len);
+        memcpy(prev, v + 3 * (lo + len - 1), 3);
+    }
+}
+
+void DecipherInPlaceTask(void *arg, int k) {
+    cipherJob *job = arg;
+    size_t start = k * (*job).segment;
+    size_t end = min(start + (*job).segment, (*job).n);
+    unsigned char *v = (*job).out, prev[3], c[3 * BLOCK];
+    uint32_t r[BLOCK];
+    size_t lo, len;
+
+    if(start == 0 || (*job).segmented)
+        SetIV(prev, (*job).segmented ? SegmentIV((*job).sv, k) : (*job).sv);
+    else
+        memcpy(prev, (*job).carry + 3 * k, 3);
+
+    // blocul criptat se copiaza inainte, pentru ca fiecare pixel are nevoie de predecesorul criptat
+    for(lo = start; lo < end; lo += len) {
+        len = min(BLOCK, end - lo);
+        Xorshift32Segment((*job).r0, r, (*job).n + lo, len);
+        memcpy(c, v + 3 * lo, 3 * len);
+
+        XorKeystream(v + 3 * lo, c, prev, r, 1);
+        XorKeystream(v + 3 * lo + 3, c + 3, c, r + 1, len - 1);
+        memcpy(prev, c + 3 * (len - 1), 3);
+    }
+}
+
+// aplica pe loc out[p[i]] = v[i] (inverse = 0) sau out[i] = v[p[i]] (inverse = 1), urmarind ciclurile
+// permutarii; bitmap-ul marcheaza pozitiile deja mutate
+void PermuteCycles(unsigned char *v, int const *p, size_t n, int inverse) {
+    unsigned char *visited = calloc(n / 8 + 1, 1);
+    unsigned char carry[3], aux[3];
+    size_t s, j;
+
+    for(s = 0; s < n; s ++) {
+        if(visited[s / 8] & 1 << s % 8)
+            continue;
+        visited[s / 8] |= 1 << s % 8;
+
+        if(!inverse) {
+            memcpy(carry, v + 3 * s, 3);
+            for(j = p[s]; j != s; j = p[j]) {
+                memcpy(aux, v + 3 * j, 3);
+                memcpy(v + 3 * j, carry, 3);
+                memcpy(carry, aux, 3);
+                visited[j / 8] |= 1 << j % 8;
+            }
+            memcpy(v + 3 * s, carry, 3);
+        } else {
+            memcpy(carry, v + 3 * s, 3);
+            for(j = s; p[j] != s; j = p[j]) {
+                memcpy(v + 3 * j, v + 3 * (size_t) p[j], 3);
+                visited[p[j] / 8] |= 1 << p[j] % 8;
+            }
+            memcpy(v + 3 * j, carry, 3);
+        }
+    }
+
+    free(visited);
+}
+
+// varianta cu memorie redusa: doar imaginea si cateva blocuri de cheie, fara r, p si copii ale pixelilor;
+// amestecarea pe galeti nu se poate reface pe loc, asa ca acolo se pastreaza p (4n octeti) si un bitmap
+void EncryptInPlace(imageData *v, uint32_t r0, uint32_t sv, cryptMode m) {
+    size_t n = (size_t) (*v).width * (*v).height;
+    int segmented = m.cipher == CIPHER_SEGMENTED;
+    cipherJob job = {(*v).pixel, NULL, NULL, sv, n, segmented ? (size_t) 1 << m.segmentLog : n, segmented, r0, NULL};
+    int *p;
+    PROBE_START(start);
+
+    if(m.shuffle == SHUFFLE_BUCKETS) {
+        p = BucketShuffle(r0, n);
+        PermuteCycles((*v).pixel, p, n, 0);
+        free(p);
+    } else {
+        PermuteInPlace((*v).pixel, r0, n);
+    }
+    if(n > 0)
+        ParallelFor((n + job.segment - 1) / job.segment, EncipherInPlaceTask, &job);
+    WriteMode(v, m);
+    PROBE_STOP(PROBE_ENCRYPT_IN_PLACE, start);
+}
+
+int DecryptInPlace(imageData *v, uint32_t r0, uint32_t sv) {
+    size_t n = (size_t) (*v).width * (*v).height;
+    int segmented, tasks, k, *p;
+    unsigned char *carry;
+    cipherJob job;
+    cryptMode m;
+    PROBE_START(start);
+
+    if(ReadMode(*v, &m) < 0)
+        return -1;
+    segmented = m.cipher == CIPHER_SEGMENTED;
+    job = (cipherJob) {(*v).pixel, NULL, NULL, sv, n, (size_t) 1 << (segmented ? m.segmentLog : 16), segmented, r0, NULL};
+    tasks = (n + job.segment - 1) / job.segment;
+
+    if(!segmented && tasks > 4 * PoolThreads()) {
+        tasks = 4 * PoolThreads();
+        job.segment = (n + tasks - 1) / tasks;
+    }
+
+    // ultimul pixel criptat dinaintea fiecarei bucati, salvat inainte ca bucata vecina sa-l suprascrie
+    carry = malloc(3 * (size_t) tasks);
+    for(k = 1; k < tasks; k ++) {
+        memcpy(carry + 3 * k, (*v).pixel + 3 * (k * job.segment - 1), 3);
+    }
+    job.carry = carry;
+
+    ParallelFor(tasks, DecipherInPlaceTask, &job);
+    if(m.shuffle == SHUFFLE_BUCKETS) {
+        p = BucketShuffle(r0, n);
+        PermuteCycles((*v).pixel, p, n, 1);
+        free(p);
+    } else {
+        ReverseInPlace((*v).pixel, r0, n);
+    }
+    ClearMode(v);
+
+    free(carry);
+    PROBE_STOP(PROBE_DECRYPT_IN_PLACE, start);
+    return 0;
+}
+
+int ReadKey(char *SecretKeyPath, uint32_t *r0, uint32_t *sv) {
+    FILE *in = fopen(SecretKeyPath, "r");
+    int ok;
+
+    if(in == NULL) {
+        perror(SecretKeyPath);
+        return -1;
+    }
+    ok = fscanf(in, "%u %u", r0, sv) == 2;
+    fclose(in);
+
+    if(!ok) {
+        fprintf(stderr, "%s: expected two unsigned integers\n", SecretKeyPath);
+        return -1;
+    }
+    return 0;
+}
+
+void InitialisePixels(pixelRGB f[], pixelRGB *x) {
+    int i;
+    for(i = 0; i < 256; i ++) {
+        f[i].blue = 0;
+        f[i].green = 0;
+        f[i].red = 0;
+    }
+
+    (*x).blue = 0;
+    (*x).green = 0;
+    (*x).red = 0;
+}
+
+void CalcChi(pixelRGB f[], pixelRGB *x, double f_med) {
+    int i;
+    for(i = 0; i < 256; i ++) {
+        (*x).blue += ((f[i].blue - f_med) * (f[i].blue - f_med) / f_med);
+        (*x).green += ((f[i].green - f_med) * (f[i].green - f_med) / f_med);
+        (*x).red += ((f[i].red - f_med) * (f[i].red - f_med) / f_med);
+    }
+}
+
+// aduna sumele din vectori in canalele lor: pozitia 16 * c + l dintr-un bloc de 48 de octeti este canalul (16 * c + l) % 3
+void FlushLanes(wide32 lane[][3], uint64_t acc[][3], int kinds) {
+    int kind, c, l;
+
+    for(kind = 0; kind < kinds; kind ++) {
+        for(c = 0; c < 3; c ++) {
+            for(l = 0; l < 16; l ++) {
+                acc[kind][(16 * c + l) % 3] += lane[kind][c][l];
+            }
+            lane[kind][c] = (wide32) {0};
+        }
+    }
+}
+
+void LoadBytes(half16 *x, unsigned char const *v) {
+    bytes16 b;
+    memcpy(&b, v, 16);
+    (*x) = __builtin_convertvector(b, half16);
+}
+
+void WidenLanes(wide32 lane[][3], half16 part[][3], int kinds) {
+    int kind, c;
+
+    for(kind = 0; kind < kinds; kind ++) {
+        for(c = 0; c < 3; c ++) {
+            lane[kind][c] += WIDEN(part[kind][c]);
+            part[kind][c] = (half16) {0};
+        }
+    }
+}
+
+// pentru randul a si randul urmator b: sum, square, apoi produsele cu vecinul din dreapta, de jos si de pe diagonala.
+// len = 3 * (width - 1) octeti au vecin in dreapta; ultimul pixel intra doar in sume si pe verticala
+void RowMoments(unsigned char const *a, unsigned char const *b, size_t len, uint64_t acc[5][3]) {
+    wide32 lane[5][3] = {{{0}}};
+    half16 x, y[3];
+    size_t j = 0, chunks = 0;
+    int c;
+
+    for(; j + 48 <= len; j += 48) {
+        for(c = 0; c < 3; c ++) {
+            LoadBytes(&x, a + j + 16 * c);
+            LoadBytes(y, a + j + 16 * c + 3);
+            LoadBytes(y + 1, b + j + 16 * c);
+            LoadBytes(y + 2, b + j + 16 * c + 3);
+            lane[0][c] += WIDEN(x);
+            lane[1][c] += WIDEN(x * x);
+            lane[2][c] += WIDEN(x * y[0]);
+            lane[3][c] += WIDEN(x * y[1]);
+            lane[4][c] += WIDEN(x * y[2]);
+        }
+        // 2^12 blocuri * 255^2 incap pe 32 de biti
+        if(++ chunks == 1 << 12) {
+            FlushLanes(lane, acc, 5);
+            chunks = 0;
+        }
+    }
+    FlushLanes(lane, acc, 5);
+
+    for(; j < len + 3; j ++) {
+        acc[0][j % 3] += a[j];
+        acc[1][j % 3] += a[j] * a[j];
+        acc[3][j % 3] += a[j] * b[j];
+        if(j < len) {
+            acc[2][j % 3] += a[j] * a[j + 3];
+            acc[4][j % 3] += a[j] * b[j + 3];
+        }
+    }
+}
+
+// NPCR si UACI: cate valori difera si suma diferentelor absolute, pe canale
+void RowDistance(unsigned char const *a, unsigned char const *b, size_t len, uint64_t acc[2][3]) {
+    wide32 lane[2][3] = {{{0}}};
+    half16 part[2][3] = {{{0}}}, x, y;
+    short16 d;
+    size_t j = 0, chunks = 0;
+    int c;
+
+    for(; j + 48 <= len; j += 48) {
+        for(c = 0; c < 3; c ++) {
+            LoadBytes(&x, a + j + 16 * c);
+            LoadBytes(&y, b + j + 16 * c);
+            d = (short16) (x - y);
+            part[0][c] -= (half16) (x != y);
+            part[1][c] += (half16) ((d ^ (d >> 15)) - (d >> 15));
+        }
+        // 256 * 255 incape inca pe 16 biti
+        if(++ chunks == 256) {
+            WidenLanes(lane, part, 2);
+            chunks = 0;
+        }
+    }
+    WidenLanes(lane, part, 2);
+    FlushLanes(lane, acc, 2);
+
+    for(; j < len; j ++) {
+        acc[0][j % 3] += a[j] != b[j];
+        acc[1][j % 3] += a[j] > b[j] ? a[j] - b[j] : b[j] - a[j];
+    }
+}
+
+// histogramele se numara in 4 copii, pixelii consecutivi in copii diferite, ca incrementarile
+// aceleiasi valori sa nu astepte una dupa alta
+void StatsTask(void *arg, int k) {
+    statsJob *job = arg;
+    imageData v = (*job).v;
+    statsSums *s = (*job).part + k;
+    size_t row = 3 * (size_t) v.width, i, l;
+    unsigned int y, start = k * (*job).rows, end = min(start + (*job).rows, v.height);
+    uint32_t sub[4][3][256] = {{{0}}};
+    uint64_t acc[5][3] = {{0}};
+    unsigned char const *a, *b;
+    int c, x;
+
+    for(y = start; y < end; y ++) {
+        a = v.pixel + y * row;
+        // ultimul rand nu are vecin dedesubt; produsele lui cu el insusi se arunca
+        b = y + 1 < v.height ? a + row : a;
+        for(i = 0; i + 4 <= v.width; i += 4) {
+            for(l = 0; l < 4; l ++) {
+                sub[l][0][a[3 * (i + l)]] ++;
+                sub[l][1][a[3 * (i + l) + 1]] ++;
+                sub[l][2][a[3 * (i + l) + 2]] ++;
+            }
+        }
+        for(; i < v.width; i ++) {
+            sub[0][0][a[3 * i]] ++;
+            sub[0][1][a[3 * i + 1]] ++;
+            sub[0][2][a[3 * i + 2]] ++;
+        }
+
+        memset(acc, 0, sizeof(acc));
+        RowMoments(a, b, row - 3, acc);
+        for(c = 0; c < 3; c ++) {
+            (*s).sum[c] += acc[0][c];
+            (*s).square[c] += acc[1][c];
+            (*s).cross[0][c] += acc[2][c];
+            if(b != a) {
+                (*s).cross[1][c] += acc[3][c];
+                (*s).cross[2][c] += acc[4][c];
+            }
+        }
+
+        if((*job).w != NULL)
+            RowDistance(a, (*job).w + y * row, row, (*s).distance);
+    }
+
+    for(l = 0; l < 4; l ++) {
+        for(c = 0; c < 3; c ++) {
+            for(x = 0; x < 256; x ++) {
+                (*s).hist[c][x] += sub[l][c][x];
+            }
+        }
+    }
+}
+
+// sumele pe o linie de pixeli (rand sau coloana), scazute din totaluri pentru perechile care nu exista
+void LineSums(imageData v, size_t first, size_t step, size_t count, double s[2][3]) {
+    size_t i;
+    int c;
+
+    for(c = 0; c < 3; c ++) {
+        s[0][c] = s[1][c] = 0;
+    }
+    for(i = 0; i < count; i ++) {
+        for(c = 0; c < 3; c ++) {
+            s[0][c] += v.pixel[first + i * step + c];
+            s[1][c] += v.pixel[first + i * step + c] * v.pixel[first + i * step + c];
+        }
+    }
+}
+
+double Correlation(double n, double sx, double sy, double qx, double qy, double sxy) {
+    double mx = sx / n, my = sy / n;
+    double d = (qx / n - mx * mx) * (qy / n - my * my);
+
+    if(n <= 0 || d <= 0)
+        return 0;
+    return (sxy / n - mx * my) / sqrt(d);
+}
+
+// o singura trecere prin pixeli, impartita pe benzi de randuri; reference (optional, aceeasi dimensiune)
+// da NPCR si UACI. Sumele partiale stau in context, deci apelurile repetate nu aloca
+void StatsBuffer(cryptContext *context, unsigned char const *pixel, unsigned char const *reference, unsigned int width, unsigned int height, imageStats *st) {
+    size_t n = (size_t) width * height, row = 3 * (size_t) width;
+    statsJob job = {{height, width, 0}, reference};
+    imageData *v = &job.v;
+    statsSums s = {{{0}}};
+    pixelRGB f[256], x;
+    double first[2][3], last[2][3], top[2][3], bottom[2][3], p, q[3][2][3], e[3], f_med = n / 256.0;
+    unsigned char const *end;
+    int tasks, k, c, i, d;
+
+    memset(st, 0, sizeof(imageStats));
+    if(n == 0)
+        return;
+
+    tasks = min(height, 4 * (size_t) PoolThreads());
+    job.rows = (height + tasks - 1) / tasks;
+    tasks = (height + job.rows - 1) / job.rows;
+    job.v.pixel = (unsigned char *) pixel;
+    job.part = Reserve(&(*context).scratch.stats, tasks * sizeof(statsSums));
+    memset(job.part, 0, tasks * sizeof(statsSums));
+    ParallelFor(tasks, StatsTask, &job);
+
+    for(k = 0; k < tasks; k ++) {
+        for(c = 0; c < 3; c ++) {
+            for(i = 0; i < 256; i ++) {
+                s.hist[c][i] += job.part[k].hist[c][i];
+            }
+            s.sum[c] += job.part[k].sum[c];
+            s.square[c] += job.part[k].square[c];
+            for(d = 0; d < 3; d ++) {
+                s.cross[d][c] += job.part[k].cross[d][c];
+            }
+            s.distance[0][c] += job.part[k].distance[0][c];
+            s.distance[1][c] += job.part[k].distance[1][c];
+        }
+    }
+
+    // chi-patrat cu aceleasi calcule ca varianta initiala, pe frecventele numarate exact
+    InitialisePixels(f, &x);
+    for(i = 0; i < 256; i ++) {
+        f[i].blue = s.hist[0][i];
+        f[i].green = s.hist[1][i];
+        f[i].red = s.hist[2][i];
+    }
+    CalcChi(f, &x, f_med);
+    (*st).chi[0] = x.blue;
+    (*st).chi[1] = x.green;
+    (*st).chi[2] = x.red;
+
+    for(c = 0; c < 3; c ++) {
+        for(i = 0; i < 256; i ++) {
+            p = (double) s.hist[c][i] / n;
+            if(p > 0)
+                (*st).entropy[c] -= p * log2(p);
+        }
+    }
+
+    // primul element al perechii nu poate fi pe ultima coloana/rand, al doilea pe prima coloana/rand
+    LineSums(*v, 0, row, height, first);
+    LineSums(*v, row - 3, row, height, last);
+    LineSums(*v, 0, 3, width, top);
+    LineSums(*v, (height - 1) * row, 3, width, bottom);
+    end = (*v).pixel + 3 * (n - 1);
+    for(c = 0; c < 3; c ++) {
+        for(k = 0; k < 2; k ++) {
+            e[0] = k ? (double) s.square[c] : (double) s.sum[c];
+            q[0][k][c] = e[0] - last[k][c];
+            q[1][k][c] = e[0] - bottom[k][c];
+            q[2][k][c] = e[0] - bottom[k][c] - last[k][c] + (k ? end[c] * end[c] : end[c]);
+        }
+        (*st).correlation[0][c] = Correlation((double) (width - 1) * height, q[0][0][c], s.sum[c] - first[0][c],
+                                              q[0][1][c], s.square[c] - first[1][c], s.cross[0][c]);
+        (*st).correlation[1][c] = Correlation((double) width * (height - 1), q[1][0][c], s.sum[c] - top[0][c],
+                                              q[1][1][c], s.square[c] - top[1][c], s.cross[1][c]);
+        e[1] = s.sum[c] - top[0][c] - first[0][c] + (*v).pixel[c];
+        e[2] = s.square[c] - top[1][c] - first[1][c] + (*v).pixel[c] * (*v).pixel[c];
+        (*st).correlation[2][c] = Correlation((double) (width - 1) * (height - 1), q[2][0][c], e[1],
+                                              q[2][1][c], e[2], s.cross[2][c]);
+    }
+
+    if(reference != NULL) {
+        (*st).compared = 1;
+        for(c = 0; c < 3; c ++) {
+            (*st).npcr[c] = 100.0 * s.distance[0][c] / n;
+            (*st).uaci[c] = 100.0 * s.distance[1][c] / (255.0 * n);
+        }
+    }
+}
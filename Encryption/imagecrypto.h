@@ -0,0 +1,113 @@
+#ifndef IMAGECRYPTO_H
+#define IMAGECRYPTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "bmpio.h"
+#include "pool.h"
+#include "probe.h"
+
+// octetii rezervati 6-9 din header marcheaza modul de criptare; fisierele vechi au 0 acolo
+#define FORMAT_TAG 'X'
+#define CIPHER_LEGACY 0
+#define CIPHER_SEGMENTED 1
+#define SEGMENT_LOG 16
+#define SHUFFLE_DURSTENFELD 0
+#define SHUFFLE_BUCKETS 1
+
+// timerele proprii, dupa cele comune din probe.h; numele lor sunt date la PROBE_INIT, in main
+#define PROBE_ENCRYPT (PROBE_COMMON_TIMERS + 0)
+#define PROBE_DECRYPT (PROBE_COMMON_TIMERS + 1)
+#define PROBE_ENCRYPT_IN_PLACE (PROBE_COMMON_TIMERS + 2)
+#define PROBE_DECRYPT_IN_PLACE (PROBE_COMMON_TIMERS + 3)
+
+typedef struct {
+    unsigned char cipher, segmentLog, shuffle;
+} cryptMode;
+
+typedef struct {
+    scratchBuffer pixel, spare, r, p, entry, cursor, stats;
+} cryptScratch;
+
+// r si p pentru o pereche (r0, n) si un mod de amestecare; sv nu intervine in ele.
+// map este fisierul de pe disc, mapat privat (r e in el, p e o copie verificata), sau NULL cand r e alocat
+typedef struct cacheEntry {
+    uint32_t r0;
+    size_t n, bytes;
+    unsigned char shuffle;
+    uint32_t *r;
+    int *p;
+    void *map;
+    int users, detached;
+    struct cacheEntry *prev, *next;
+} cacheEntry;
+
+// intrari partajate intre contexte (si fire), cel mult limit octeti in memorie, scoase in ordinea LRU;
+// cu directory, intrarile se pastreaza si pe disc (cel mult diskLimit octeti) si se mapeaza la cerere
+typedef struct {
+    pthread_mutex_t lock;
+    cacheEntry *head, *tail;
+    size_t bytes, limit, diskLimit;
+    char *directory;
+    unsigned long hits, diskHits, misses, evictions;
+} keyCache;
+
+// cheia, modul si memoria refolosita intre apeluri; r si p raman valabile cat timp cheia,
+// numarul de pixeli n si amestecarea nu se schimba (n = 0: nimic pregatit)
+typedef struct {
+    uint32_t r0, sv;
+    cryptMode m;
+    cryptScratch scratch;
+    size_t n;
+    unsigned char shuffle;
+    uint32_t const *r;
+    int const *p;
+    keyCache *cache;
+    cacheEntry *entry;
+} cryptContext;
+
+// cross si correlation: [0] orizontal, [1] vertical, [2] diagonal; canalele in ordinea albastru, verde, rosu
+typedef struct {
+    double chi[3], entropy[3], correlation[3][3], npcr[3], uaci[3];
+    int compared;
+} imageStats;
+
+// lucrul cu memoria apelantului: un context pentru fiecare fir care cripteaza
+void InitialiseContext(cryptContext *c, uint32_t r0, uint32_t sv, cryptMode m);
+void SetKey(cryptContext *c, uint32_t r0, uint32_t sv);
+void FreeContext(cryptContext *c);
+void EncryptBuffer(cryptContext *c, unsigned char *pixel, size_t n);
+void DecryptBuffer(cryptContext *c, unsigned char *pixel, size_t n);
+void InitialiseCache(keyCache *k, size_t limit, char *directory, size_t diskLimit);
+void FreeCache(keyCache *k);
+void UseCache(cryptContext *c, keyCache *k);
+void StatsBuffer(cryptContext *context, unsigned char const *pixel, unsigned char const *reference, unsigned int width, unsigned int height, imageStats *st);
+
+// cheia si decriptarea: functiile care intorc int (ReadKey, Decrypt, DecryptInPlace, ReadMode) dau -1 la eroare, cu
+// mesajul deja afisat, ca ReadImage/WriteImage din bmpio.h; doar LoadImage/SaveImage opresc programul
+int ReadKey(char *SecretKeyPath, uint32_t *r0, uint32_t *sv);
+
+// criptarea unei imagini cu modul marcat in header; variantele InPlace folosesc memorie cat imaginea. Decriptarea
+// refuza un mod necunoscut din header (-1) si lasa imaginea neschimbata
+void Encrypt(imageData *v, cryptContext *c);
+int Decrypt(imageData *v, cryptContext *c);
+void EncryptInPlace(imageData *v, uint32_t r0, uint32_t sv, cryptMode m);
+int DecryptInPlace(imageData *v, uint32_t r0, uint32_t sv);
+int ReadMode(imageData v, cryptMode *m);
+
+// etapele separate, pentru benchmark-uri
+uint32_t Xorshift32(uint32_t state[static 1]);
+uint32_t *CallXorshift32(uint32_t r0, int length);
+int *DurstenfeldAlgorithm(uint32_t const *r, int n);
+int *BucketShuffle(uint32_t r0, int n);
+int *Reverse(int const *p, int n);
+unsigned char *Permute(unsigned char const *v, int const *p, int n);
+unsigned char *Gather(unsigned char const *v, int const *p, int n);
+void StorePixel(unsigned char *v, uint32_t x);
+void CipheredImage(unsigned char *v, uint32_t sv, unsigned char const *p, uint32_t const *r, int n);
+void CipheredSegments(unsigned char *v, uint32_t sv, unsigned char const *p, uint32_t const *r, int n, int segmentLog);
+void DecipheredImage(unsigned char *v, uint32_t sv, unsigned char const *p, uint32_t const *r, int n, cryptMode m);
+
+#endif
@@ -2,355 +2,1199 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "imagecrypto.h"
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define LATENCY_BUCKETS 16
 
-#define MASK (1<<8) - 1;
+typedef struct {
+    char mode, *input, *output, *key;
+    size_t bytes;
+    double seconds;
+    int failed;
+} batchJob;
+
+// fiecare fir isi ia lucrarile de la coada listei proprii, iar cand ramane fara fura de la capul altora
+typedef struct {
+    pthread_mutex_t lock;
+    int *job, head, tail;
+} workQueue;
 
 typedef struct {
-    double blue, green, red;
-} pixelRGB;
+    batchJob *job;
+    workQueue *queue;
+    int workers, lowMemory;
+    cryptMode m;
+    keyCache *cache;
+} batchRun;
 
 typedef struct {
-    unsigned int height, width, padding;
-    unsigned char header[54];
-    unsigned char *pixel;
-} imageData;
+    batchRun *run;
+    int id;
+    pthread_t thread;
+} batchWorker;
+
+typedef struct server server;
+
+// o conexiune ramane deschisa cat timp mai are cereri fara raspuns (pending numara si cititorul); cat timp cititorul
+// ruleaza, ea e si in lista open a serverului (prev, next, sub lacatul serverului)
+typedef struct connection {
+    server *s;
+    int fd, pending;
+    pthread_mutex_t lock;
+    struct connection *prev, *next;
+} connection;
 
-uint32_t Xorshift32(uint32_t state[static 1]) {
-    uint32_t x = state[0];
-    x ^= x << 13;
-    x ^= x >> 17;
-    x ^= x << 5;
-    state[0] = x;
-    return x;
+typedef struct {
+    connection *from;
+    long seq;
+    batchJob job;
+    char *reference;
+    double queued;
+} request;
+
+// coada marginita dintre cititori si workeri, plus contoarele pentru comanda status; open sunt conexiunile cu
+// cititorul inca pornit, iar idle e semnalat cand nu mai ramane niciuna
+struct server {
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty, notFull, idle;
+    request **slot;
+    connection *open;
+    int capacity, head, count, stopping, workers, lowMemory, listenFd;
+    char *socketPath;
+    cryptMode m;
+    keyCache *cache;
+    double started, bytes, latency;
+    unsigned long accepted, completed, failed, histogram[LATENCY_BUCKETS];
+};
+
+void ReportMemory(imageData v) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Peak memory: %ld KB for a %zu KB image\n", usage.ru_maxrss, 3 * (size_t) v.width * v.height / 1024);
 }
 
-void FindHeader(FILE *in, imageData *v) {
-    int i;
-    for(i = 0; i < 54; i ++) {
-        fread(&(*v).header[i], 1, 1, in);
-    }
+void PrintCache(keyCache *k) {
+    printf("Key cache: %lu hits, %lu from disk, %lu misses, %lu evictions, %.1f MB in memory\n", (*k).hits, (*k).diskHits,
+           (*k).misses, (*k).evictions, (*k).bytes / 1e6);
+}
+
+// k poate fi NULL
+void CallEncrypt(char *originalImagePath, char *encryptedImagePath, char *SecretKeyPath, cryptMode m, int lowMemory, keyCache *k) {
+    uint32_t r0, sv;
+
+    if(ReadKey(SecretKeyPath, &r0, &sv) < 0)
+        exit(EXIT_FAILURE);
+
+    imageData v = LoadImage(originalImagePath);
+    cryptContext c;
+
+    InitialiseContext(&c, r0, sv, m);
+    if(k != NULL)
+        UseCache(&c, k);
+    if(lowMemory)
+        EncryptInPlace(&v, r0, sv, m);
+    else
+        Encrypt(&v, &c);
+    SaveImage(v, encryptedImagePath);
 
-    fseek(in, 18, SEEK_SET);
-    fread(&(*v).width, sizeof(unsigned int), 1, in);
-    fread(&(*v).height, sizeof(unsigned int), 1, in);
+    if(lowMemory)
+        ReportMemory(v);
+
+    FreeContext(&c);
+    free(v.pixel);
 }
 
-void FindPadding(imageData *v) {
-    if((*v).width % 4 != 0)
-        (*v).padding = 4 - (3 * (*v).width) % 4;
+void CallDecrypt(char *encryptedImagePath, char *decryptedImagePath, char *SecretKeyPath, int lowMemory, keyCache *k) {
+    uint32_t r0, sv;
+
+    if(ReadKey(SecretKeyPath, &r0, &sv) < 0)
+        exit(EXIT_FAILURE);
+
+    imageData v = LoadImage(encryptedImagePath);
+    cryptContext c;
+    cryptMode m;
+    int status;
+
+    if(ReadMode(v, &m) < 0)
+        exit(EXIT_FAILURE);
+    InitialiseContext(&c, r0, sv, m);
+    if(k != NULL)
+        UseCache(&c, k);
+    if(lowMemory)
+        status = DecryptInPlace(&v, r0, sv);
     else
-        (*v).padding = 0;
+        status = Decrypt(&v, &c);
+    // mesajul e deja afisat; nu se scrie nimic
+    if(status < 0) {
+        FreeContext(&c);
+        free(v.pixel);
+        exit(EXIT_FAILURE);
+    }
+    SaveImage(v, decryptedImagePath);
+
+    if(lowMemory)
+        ReportMemory(v);
+
+    FreeContext(&c);
+    free(v.pixel);
 }
 
-void FindPixels(FILE *in, imageData *v) {
-    (*v).pixel = (unsigned char*) malloc(3 * (*v).height * (*v).width * sizeof(unsigned char));
+void PrintStatistics(char *imagePath, imageStats st, char *referencePath) {
+    char const *direction[] = {"horizontal", "vertical", "diagonal"};
+    int d;
 
-    fseek(in, 54, SEEK_SET);
-    int i, j, poz = 0;
+    printf("Chi-squared test on RGB channels for %s:\nR:%.2lf\nG:%.2lf\nB:%.2lf\n", imagePath, st.chi[2], st.chi[1], st.chi[0]);
+    printf("Entropy: R %.5lf G %.5lf B %.5lf\n", st.entropy[2], st.entropy[1], st.entropy[0]);
+    for(d = 0; d < 3; d ++) {
+        printf("Correlation (%s): R %.5lf G %.5lf B %.5lf\n", direction[d], st.correlation[d][2], st.correlation[d][1], st.correlation[d][0]);
+    }
+    if(st.compared) {
+        printf("NPCR against %s: R %.4lf%% G %.4lf%% B %.4lf%%\n", referencePath, st.npcr[2], st.npcr[1], st.npcr[0]);
+        printf("UACI against %s: R %.4lf%% G %.4lf%% B %.4lf%%\n", referencePath, st.uaci[2], st.uaci[1], st.uaci[0]);
+    }
+}
 
-    for(i = 1; i <= (*v).height; i ++) {
-        fseek(in, (- 1) * i * (3 * (*v).width + (*v).padding),SEEK_END);
-        for(j = 0; j < 3 * (*v).width; j ++, poz ++) {
-            fread(&(*v).pixel[poz], 1, 1, in);
+// referencePath poate fi NULL; altfel imaginea de referinta trebuie sa aiba aceeasi dimensiune
+void ChiSquaredTest(char *imagePath, char *referencePath) {
+    imageData v = LoadImage(imagePath), w;
+    cryptContext c = {0};
+    imageStats st;
+
+    if(referencePath != NULL) {
+        w = LoadImage(referencePath);
+        if(w.width != v.width || w.height != v.height) {
+            fprintf(stderr, "%s: size differs from %s, skipping NPCR/UACI\n", referencePath, imagePath);
+            free(w.pixel);
+            referencePath = NULL;
         }
-
-        fseek(in, (*v).padding, SEEK_CUR);
     }
+
+    StatsBuffer(&c, v.pixel, referencePath != NULL ? w.pixel : NULL, v.width, v.height, &st);
+    PrintStatistics(imagePath, st, referencePath);
+    FreeContext(&c);
+
+    if(referencePath != NULL)
+        free(w.pixel);
+    free(v.pixel);
 }
 
-imageData LoadImage(char *ImagePath) {
-    FILE *in = fopen(ImagePath, "rb");
-    imageData v;
+void TaskI(char *imagePath, cryptMode m, int lowMemory, keyCache *k) {
+    char secretKeyPath[101], encryptedImagePath[101];
 
-    FindHeader(in, &v);
-    FindPadding(&v);
-    FindPixels(in, &v);
+    printf("Numele fisierului care contine imaginea initiala: ");
+    fgets(imagePath, 101, stdin);   imagePath[strlen(imagePath) - 1] = '\0';
 
-    fclose(in);
-    return v;
+    printf("Numele fisierului care va contine imaginea criptata : ");
+    fgets(encryptedImagePath, 101, stdin);  encryptedImagePath[strlen(encryptedImagePath) - 1] = '\0';
+
+    printf("Numele fisierului care contine cheia secreta : ");
+    fgets(secretKeyPath, 101, stdin);   secretKeyPath[strlen(secretKeyPath) - 1] = '\0';
+
+    CallEncrypt(imagePath, encryptedImagePath, secretKeyPath, m, lowMemory, k);
 }
 
-void SaveHeader(FILE *out, imageData v) {
-    int i;
-    for(i = 0; i < 54; i ++) {
-        fwrite(&v.header[i], 1, 1, out);
-    }
+void TaskII(char *encryptedImagePath, int lowMemory, keyCache *k) {
+    char secretKeyPath[101], decryptedImagePath[101];
+
+    printf("Numele fisierului care contine imaginea criptata : ");
+    fgets(encryptedImagePath, 101, stdin);  encryptedImagePath[strlen(encryptedImagePath) - 1] = '\0';
+
+    printf("Numele fisierului in care va contine imaginea decriptata : ");
+    fgets(decryptedImagePath, 101, stdin);  decryptedImagePath[strlen(decryptedImagePath) - 1] = '\0';
+
+    printf("Numele fisierului care contine cheia secreta : ");
+    fgets(secretKeyPath, 101, stdin);   secretKeyPath[strlen(secretKeyPath) - 1] = '\0';
+
+    CallDecrypt(encryptedImagePath, decryptedImagePath, secretKeyPath, lowMemory, k);
+}
+
+void TaskIII(char *imagePath, char *encryptedImagePath) {
+    ChiSquaredTest(imagePath, NULL);
+    ChiSquaredTest(encryptedImagePath, imagePath);
 }
 
-void SavePixels(FILE *out, imageData v) {
-    int i, j, poz = 0;
-    unsigned char c = 0;
-    for (i = v.height - 1; i >= 0; i --) {
-        poz = 3 * i * v.width;
-        for (j = 0; j < 3 * v.width; j ++, poz ++) {
-            fwrite(&v.pixel[poz], 1, 1, out);
+// compara mutarea pixel cu pixel din varianta initiala (cu tot cu alocarea rezultatului) cu Permute/Gather,
+// la 1, 16 si 100 de megapixeli
+void PermuteBenchmark(void) {
+    int sizes[] = {1 << 20, 16 << 20, 100 << 20};
+    unsigned char *v, *a, *b;
+    uint32_t *r;
+    int *p, *pp, i, k, n;
+    double t[5];
+
+    printf("%10s %14s %14s %14s %14s\n", "pixels", "naive scatter", "Permute", "naive inverse", "Gather");
+    for(k = 0; k < 3; k ++) {
+        n = sizes[k];
+        r = CallXorshift32(k + 1, n);
+        p = DurstenfeldAlgorithm(r, n);
+        v = malloc(3 * (size_t) n);
+        for(i = 0; i < n; i ++) {
+            StorePixel(v + 3 * (size_t) i, r[i]);
         }
+        free(r);
 
-        for(j = 0; j < v.padding; j ++) {
-            fwrite(&c, 1, 1, out);
+        t[0] = Now();
+        a = malloc(3 * (size_t) n);
+        for(i = 0; i < n; i ++) {
+            memcpy(a + 3 * (size_t) p[i], v + 3 * (size_t) i, 3);
+        }
+        t[1] = Now();
+        b = Permute(v, p, n);
+        t[2] = Now();
+        if(memcmp(a, b, 3 * (size_t) n) != 0)
+            printf("Permute mismatch at %d pixels\n", n);
+        free(a);
+        free(b);
+
+        t[2] = Now();
+        pp = Reverse(p, n);
+        a = malloc(3 * (size_t) n);
+        for(i = 0; i < n; i ++) {
+            memcpy(a + 3 * (size_t) pp[i], v + 3 * (size_t) i, 3);
         }
+        t[3] = Now();
+        b = Gather(v, p, n);
+        t[4] = Now();
+        if(memcmp(a, b, 3 * (size_t) n) != 0)
+            printf("Gather mismatch at %d pixels\n", n);
+
+        printf("%10d %10.1f Mp/s %10.1f Mp/s %10.1f Mp/s %10.1f Mp/s\n", n, n / (t[1] - t[0]) / 1e6, n / (t[2] - t[1]) / 1e6,
+               n / (t[3] - t[2]) / 1e6, n / (t[4] - t[3]) / 1e6);
+
+        free(a);
+        free(b);
+        free(p);
+        free(pp);
+        free(v);
     }
 }
 
-void SaveImage(imageData v, char *NewImagePath) {
-    FILE *out = fopen(NewImagePath, "wb");
+// imagine sintetica 4:3 cu n pixeli cel putin; latimea impara, ca randurile sa aiba padding
+imageData SyntheticImage(size_t n) {
+    imageData v = {0};
+    uint32_t x = 2463534242u, size;
+    size_t i;
 
-    SaveHeader(out, v);
-    SavePixels(out, v);
+    v.width = (unsigned int) sqrt(n * 4.0 / 3) | 1;
+    v.height = (n + v.width - 1) / v.width;
+    FindPadding(&v);
+    size = 54 + (3 * v.width + v.padding) * v.height;
+
+    v.header[0] = 'B';
+    v.header[1] = 'M';
+    memcpy(v.header + 2, &size, 4);
+    v.header[10] = 54;
+    v.header[14] = 40;
+    memcpy(v.header + 18, &v.width, 4);
+    memcpy(v.header + 22, &v.height, 4);
+    v.header[26] = 1;
+    v.header[28] = 24;
+
+    // zgomot peste un gradient, ca imaginea sa nu fie nici constanta, nici complet aleatoare
+    v.pixel = malloc(3 * (size_t) v.width * v.height);
+    for(i = 0; i < 3 * (size_t) v.width * v.height; i ++) {
+        v.pixel[i] = (i / 3 % v.width + i / 3 / v.width) / 8 + (Xorshift32(&x) & 15);
+    }
+    return v;
+}
 
-    fclose(out);
+void Record(double best[], int s, double start) {
+    best[s] = min(best[s], Now() - start);
 }
 
-uint32_t *CallXorshift32(uint32_t r0, int length) {
-    uint32_t x[2];
-    x[0] = r0;
-    uint32_t *r = malloc(length * sizeof(uint32_t));
-    int i;
-    for(i = 1; i < length; i ++) {
-        r[i] = Xorshift32(x);
-    }
-    return r;
+void PrintStage(char const *name, double seconds, size_t n, int last) {
+    printf("        {\"stage\": \"%s\", \"seconds\": %.6f, \"ns_per_pixel\": %.3f, \"mb_per_s\": %.1f}%s\n", name, seconds,
+           seconds * 1e9 / n, 3.0 * n / 1e6 / seconds, last ? "" : ",");
 }
 
-int *DurstenfeldAlgorithm(uint32_t const *r, int n) {
-    int i, j = 1, k, aux;
-    int *p = malloc(n * sizeof(int));
-    for (i = 0; i < n; i ++) {
-        p[i] = i;
+// --bench [megapixeli...]: fiecare etapa din CallEncrypt/CallDecrypt cronometrata separat pe imagini sintetice,
+// cel mai bun timp din 3 rulari, in JSON pe stdout; round_trip verifica decriptarea
+void StageBenchmark(double const *sizes, int count, cryptMode m) {
+    char const *name[] = {"SaveImage", "LoadImage", "CallXorshift32", m.shuffle == SHUFFLE_BUCKETS ? "BucketShuffle" : "DurstenfeldAlgorithm",
+                          "Permute", m.cipher == CIPHER_SEGMENTED ? "CipheredSegments" : "CipheredImage", "DecipheredImage",
+                          "Gather", "Encrypt", "Decrypt", "EncryptInPlace", "DecryptInPlace"};
+    int stages = sizeof(name) / sizeof(name[0]), k, s, run, ok;
+    char path[] = "/tmp/encryption-bench-XXXXXX";
+    double best[sizeof(name) / sizeof(name[0])], t;
+    imageData v, w, u;
+    cryptContext context;
+    unsigned char *pp, *c, *d;
+    uint32_t *r, r0 = 123456789, sv = 987654321;
+    size_t n;
+    int *p, fd;
+    struct rusage usage;
+
+    fd = mkstemp(path);
+    if(fd < 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
     }
+    close(fd);
+
+    printf("{\n  \"threads\": %d,\n  \"cipher\": \"%s\",\n  \"shuffle\": \"%s\",\n  \"images\": [\n", PoolThreads(),
+           m.cipher == CIPHER_SEGMENTED ? "segmented" : "legacy", m.shuffle == SHUFFLE_BUCKETS ? "buckets" : "durstenfeld");
+    for(k = 0; k < count; k ++) {
+        v = SyntheticImage((size_t) (sizes[k] * 1e6));
+        n = (size_t) v.width * v.height;
+        ok = 1;
+        for(s = 0; s < stages; s ++) {
+            best[s] = 1e30;
+        }
 
-    for (i = n - 1; i >= 1; i --, j ++) {
-        k = r[j] % (i + 1);
-        aux = p[i];
-        p[i] = p[k];
-        p[k] = aux;
+        for(run = 0; run < 3; run ++) {
+            s = 0;
+            t = Now();
+            SaveImage(v, path);
+            Record(best, s ++, t);
+
+            t = Now();
+            w = LoadImage(path);
+            Record(best, s ++, t);
+            ok &= memcmp(w.pixel, v.pixel, 3 * n) == 0;
+
+            t = Now();
+            r = CallXorshift32(r0, 2 * n);
+            Record(best, s ++, t);
+
+            t = Now();
+            p = m.shuffle == SHUFFLE_BUCKETS ? BucketShuffle(r0, n) : DurstenfeldAlgorithm(r, n);
+            Record(best, s ++, t);
+
+            t = Now();
+            pp = Permute(w.pixel, p, n);
+            Record(best, s ++, t);
+
+            c = malloc(3 * n);
+            t = Now();
+            if(m.cipher == CIPHER_SEGMENTED)
+                CipheredSegments(c, sv, pp, r, n, m.segmentLog);
+            else
+                CipheredImage(c, sv, pp, r, n);
+            Record(best, s ++, t);
+
+            d = malloc(3 * n);
+            t = Now();
+            DecipheredImage(d, sv, c, r, n, m);
+            Record(best, s ++, t);
+            ok &= memcmp(d, pp, 3 * n) == 0;
+
+            t = Now();
+            free(pp);
+            pp = Gather(d, p, n);
+            Record(best, s ++, t);
+            ok &= memcmp(pp, v.pixel, 3 * n) == 0;
+
+            free(r);
+            free(p);
+            free(pp);
+            free(d);
+
+            // etapele de mai sus, legate intre ele, pe o copie a imaginii incarcate; cu context nou,
+            // ca decriptarea sa nu refoloseasca cheia pregatita la criptare
+            InitialiseContext(&context, r0, sv, m);
+            t = Now();
+            Encrypt(&w, &context);
+            Record(best, s ++, t);
+            ok &= memcmp(w.pixel, c, 3 * n) == 0;
+            FreeContext(&context);
+
+            InitialiseContext(&context, r0, sv, m);
+            t = Now();
+            ok &= Decrypt(&w, &context) == 0;
+            Record(best, s ++, t);
+            ok &= memcmp(w.pixel, v.pixel, 3 * n) == 0;
+            FreeContext(&context);
+
+            u = w;
+            t = Now();
+            EncryptInPlace(&u, r0, sv, m);
+            Record(best, s ++, t);
+            ok &= memcmp(u.pixel, c, 3 * n) == 0;
+
+            t = Now();
+            ok &= DecryptInPlace(&u, r0, sv) == 0;
+            Record(best, s ++, t);
+            ok &= memcmp(u.pixel, v.pixel, 3 * n) == 0;
+
+            free(c);
+            free(w.pixel);
+        }
+
+        getrusage(RUSAGE_SELF, &usage);
+        printf("    {\n      \"pixels\": %zu,\n      \"width\": %u,\n      \"height\": %u,\n      \"bytes\": %zu,\n", n, v.width, v.height, 3 * n);
+        printf("      \"round_trip\": %s,\n      \"peak_rss_kb\": %ld,\n      \"stages\": [\n", ok ? "true" : "false", usage.ru_maxrss);
+        for(s = 0; s < stages; s ++) {
+            PrintStage(name[s], best[s], n, s == stages - 1);
+        }
+        printf("      ]\n    }%s\n", k == count - 1 ? "" : ",");
+        fflush(stdout);
+
+        if(!ok)
+            fprintf(stderr, "round trip failed at %zu pixels\n", n);
+        free(v.pixel);
     }
+    printf("  ]\n}\n");
 
-    return p;
+    unlink(path);
 }
 
-int *Reverse(int const *p, int n) {
-    int *pp = malloc(n * sizeof(int));
-    int i;
-    for(i = 0; i < n; i ++) {
-        pp[p[i]] = i;
+// o lucrare din batch; esecul unei imagini nu opreste restul
+// contextul firului pastreaza memoria si, cat timp cheia si dimensiunea se repeta, si r si p
+void RunJob(batchJob *job, cryptMode m, int lowMemory, cryptContext *c) {
+    double start = Now();
+    uint32_t r0, sv;
+    imageData v;
+    int status = 0;
+
+    (*job).failed = 1;
+    if(ReadKey((*job).key, &r0, &sv) == 0 && ReadImage((*job).input, &v, &(*c).scratch.pixel) == 0) {
+        SetKey(c, r0, sv);
+        (*c).m = m;
+        if((*job).mode == 'e' && lowMemory)
+            EncryptInPlace(&v, r0, sv, m);
+        else if((*job).mode == 'e')
+            Encrypt(&v, c);
+        else if(lowMemory)
+            status = DecryptInPlace(&v, r0, sv);
+        else
+            status = Decrypt(&v, c);
+
+        // un mod necunoscut in header: lucrarea e marcata esuata si nu se scrie nimic
+        if(status < 0)
+            fprintf(stderr, "%s: cannot decrypt\n", (*job).input);
+        else if(WriteImage(v, (*job).output) == 0) {
+            (*job).failed = 0;
+            (*job).bytes = 3 * (size_t) v.width * v.height;
+        }
     }
-    return pp;
+    (*job).seconds = Now() - start;
 }
 
-unsigned char *Permute(unsigned char const *v, int const *p, int n) {
-    unsigned char *pp = malloc(3 * n * sizeof(char));
-    int i;
-    for(i = 0; i < n; i ++) {
-        pp[3 * p[i]] = v[3 * i];
-        pp[3 * p[i] + 1] = v[3 * i + 1];
-        pp[3 * p[i] + 2] = v[3 * i + 2];
+int NextJob(batchRun *run, int id) {
+    workQueue *q;
+    int k, job = -1;
+
+    for(k = 0; k < (*run).workers && job < 0; k ++) {
+        q = (*run).queue + (id + k) % (*run).workers;
+        pthread_mutex_lock(&(*q).lock);
+        if((*q).head < (*q).tail)
+            job = k == 0 ? (*q).job[-- (*q).tail] : (*q).job[(*q).head ++];
+        pthread_mutex_unlock(&(*q).lock);
     }
-    return pp;
+    return job;
 }
 
-void InitialiseSV(pixelRGB *x, unsigned int sv) {
-    (*x).blue = sv & MASK;
-    sv >>= 8;
-    (*x).green = sv & MASK;
-    sv >>= 8;
-    (*x).red = sv & MASK;
+void *BatchWorker(void *arg) {
+    batchWorker *w = arg;
+    batchRun *run = (*w).run;
+    cryptContext c = {0};
+    int job;
+
+    InlineTasks((*run).workers > 1);
+    if((*run).cache != NULL)
+        UseCache(&c, (*run).cache);
+    while((job = NextJob(run, (*w).id)) >= 0) {
+        RunJob((*run).job + job, (*run).m, (*run).lowMemory, &c);
+    }
+
+    FreeContext(&c);
+    return NULL;
 }
 
-void XorPixels(unsigned char **v, unsigned char const *p, uint32_t const *r, pixelRGB x, int poz, int n) {
-    uint32_t rn = r[n];
-    (*v)[poz] = (unsigned char) x.blue ^ p[poz] ^ (unsigned char) rn;
-    rn >>= 8;
-    (*v)[poz + 1] = (unsigned char) x.green ^ p[poz + 1] ^ (unsigned char) rn;
-    rn >>= 8;
-    (*v)[poz + 2] = (unsigned char) x.red ^ p[poz + 2] ^ (unsigned char) rn;
+int CompareSeconds(void const *a, void const *b) {
+    double x = *(double const *) a, y = *(double const *) b;
+    return (x > y) - (x < y);
 }
 
-unsigned char *CipheredImage(uint32_t sv, unsigned char const *p, uint32_t const *r, int n) {
-    unsigned char *v = malloc(3 * n * sizeof(unsigned char));
-    int i, poz = 0;
-    pixelRGB x;
+double Percentile(double const *t, int n, double q) {
+    int k = (int) (q * n + 0.999999) - 1;
+    return t[min(max(k, 0), n - 1)];
+}
 
-    InitialiseSV(&x, sv);
-    XorPixels(&v, p, r, x, poz, n);
+// imparte lucrarile pe fire si raporteaza debitul total si latenta per fisier
+int RunBatch(batchJob *job, int count, int threads, cryptMode m, int lowMemory, keyCache *k) {
+    batchRun run = {job, NULL, min(max(threads, 1), max(count, 1)), lowMemory, m, k};
+    batchWorker *w = malloc(run.workers * sizeof(batchWorker));
+    double start, elapsed, *t = malloc(max(count, 1) * sizeof(double));
+    size_t bytes = 0;
+    int i, done = 0, failed = 0;
+
+    run.queue = malloc(run.workers * sizeof(workQueue));
+    for(i = 0; i < run.workers; i ++) {
+        pthread_mutex_init(&run.queue[i].lock, NULL);
+        run.queue[i].job = malloc(((count + run.workers - 1) / run.workers + 1) * sizeof(int));
+        run.queue[i].head = run.queue[i].tail = 0;
+    }
+    // lucrarile se impart pe rand; owner-ul le ia de la coada, deci in ordinea inversa din lista lui
+    for(i = count - 1; i >= 0; i --) {
+        workQueue *q = run.queue + i % run.workers;
+        (*q).job[(*q).tail ++] = i;
+    }
 
-    for(i = 1; i < n; i ++) {
-        x.blue = v[poz];
-        x.green = v[poz + 1];
-        x.red = v[poz + 2];
+    start = Now();
+    for(i = 0; i < run.workers; i ++) {
+        w[i].run = &run;
+        w[i].id = i;
+        if(i > 0 && pthread_create(&w[i].thread, NULL, BatchWorker, w + i) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    BatchWorker(w);
+    for(i = 1; i < run.workers; i ++) {
+        pthread_join(w[i].thread, NULL);
+    }
+    elapsed = Now() - start;
 
-        poz += 3;
-        XorPixels(&v, p, r, x, poz, n + i);
+    for(i = 0; i < count; i ++) {
+        if(job[i].failed) {
+            failed ++;
+            continue;
+        }
+        bytes += job[i].bytes;
+        t[done ++] = job[i].seconds;
     }
-    return v;
+    qsort(t, done, sizeof(double), CompareSeconds);
+
+    printf("Batch: %d files, %d failed, %.1f MB in %.2f s (%.1f MB/s) on %d threads\n", count, failed, bytes / 1e6, elapsed,
+           elapsed > 0 ? bytes / 1e6 / elapsed : 0, run.workers);
+    if(done > 0)
+        printf("Latency per file: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", 1e3 * Percentile(t, done, 0.5),
+               1e3 * Percentile(t, done, 0.9), 1e3 * Percentile(t, done, 0.99), 1e3 * t[done - 1]);
+    if(k != NULL)
+        PrintCache(k);
+
+    for(i = 0; i < run.workers; i ++) {
+        pthread_mutex_destroy(&run.queue[i].lock);
+        free(run.queue[i].job);
+    }
+    free(run.queue);
+    free(w);
+    free(t);
+    return failed;
 }
 
-void Encrypt(imageData *v, uint32_t r0, uint32_t sv) {
-    unsigned char *pp;
-    int *p;
-    uint32_t *r, n;
+void AddJob(batchJob **job, int *count, char mode, char *input, char *output, char *key) {
+    if(((*count) & ((*count) - 1)) == 0) {
+        (*job) = realloc(*job, 2 * max(*count, 1) * sizeof(batchJob));
+        PROBE_COUNT(PROBE_REALLOC, 1);
+    }
+    (*job)[*count] = (batchJob) {mode, strdup(input), strdup(output), strdup(key)};
+    (*count) ++;
+}
 
-    n = (*v).width * (*v).height;
-    r = CallXorshift32(r0, 2 * n);
-    p = DurstenfeldAlgorithm(r, n);
-    pp = Permute((*v).pixel, p, n);
-    (*v).pixel = CipheredImage(sv, pp, r, n);
+// fiecare linie: e|d <imagine> <rezultat> <cheie>; liniile goale si cele care incep cu # se ignora
+void ReadManifest(char *manifestPath, batchJob **job, int *count) {
+    FILE *in = fopen(manifestPath, "r");
+    char *line = NULL, *word[4];
+    size_t cap = 0;
+    int k, row = 0;
 
-    free(r);
-    free(p);
-    free(pp);
-}
+    if(in == NULL) {
+        perror(manifestPath);
+        exit(EXIT_FAILURE);
+    }
 
-void CallEncrypt(char *originalImagePath, char *encryptedImagePath, char *SecretKeyPath) {
-    uint32_t r0, sv;
+    while(getline(&line, &cap, in) >= 0) {
+        row ++;
+        word[0] = strtok(line, " \t\r\n");
+        if(word[0] == NULL || word[0][0] == '#')
+            continue;
+        for(k = 1; k < 4; k ++) {
+            word[k] = strtok(NULL, " \t\r\n");
+        }
 
-    FILE *in = fopen(SecretKeyPath, "r");
-    fscanf(in, "%u %u", &r0, &sv);
-    fclose(in);
+        if((word[0][0] != 'e' && word[0][0] != 'd') || word[3] == NULL) {
+            fprintf(stderr, "%s:%d: expected \"e|d <input> <output> <key>\"\n", manifestPath, row);
+            exit(EXIT_FAILURE);
+        }
+        AddJob(job, count, word[0][0], word[1], word[2], word[3]);
+    }
 
-    imageData v = LoadImage(originalImagePath);
-    Encrypt(&v, r0, sv);
-    SaveImage(v, encryptedImagePath);
+    free(line);
+    fclose(in);
+}
 
-    free(v.pixel);
+void FreeJobs(batchJob *job, int count) {
+    int i;
+    for(i = 0; i < count; i ++) {
+        free(job[i].input);
+        free(job[i].output);
+        free(job[i].key);
+    }
+    free(job);
 }
 
-unsigned char *DecipheredImage(uint32_t sv, unsigned char const *p, uint32_t const *r, int n) {
-    unsigned char *v = malloc(3 * n * sizeof(unsigned char));
-    int i, poz = 0;
-    pixelRGB x;
+void SendReply(connection *from, char const *format, ...) {
+    char text[2048];
+    size_t done = 0, size;
+    ssize_t k;
+    va_list list;
 
-    InitialiseSV(&x, sv);
-    XorPixels(&v, p, r, x, poz, n);
+    va_start(list, format);
+    size = vsnprintf(text, sizeof(text), format, list);
+    va_end(list);
+    size = min(size, sizeof(text) - 1);
 
-    for(i = 1; i < n; i ++) {
-        x.blue = p[poz];
-        x.green = p[poz + 1];
-        x.red = p[poz + 2];
+    pthread_mutex_lock(&(*from).lock);
+    while(done < size && (k = write((*from).fd, text + done, size - done)) > 0) {
+        done += k;
+    }
+    pthread_mutex_unlock(&(*from).lock);
+}
+
+void ReleaseConnection(connection *from) {
+    int last;
 
-        poz += 3;
-        XorPixels(&v, p, r, x, poz, n + i);
+    pthread_mutex_lock(&(*from).lock);
+    last = -- (*from).pending == 0;
+    pthread_mutex_unlock(&(*from).lock);
+    if(last) {
+        close((*from).fd);
+        pthread_mutex_destroy(&(*from).lock);
+        free(from);
     }
+}
 
-    return v;
+void FreeRequest(request *q) {
+    free((*q).job.input);
+    free((*q).job.output);
+    free((*q).job.key);
+    free((*q).reference);
+    free(q);
 }
 
-void Decrypt(imageData *v, uint32_t r0, uint32_t sv) {
-    unsigned char *w;
-    int *p, *pp;
-    uint32_t *r, n;
+// cititorul asteapta cat timp coada e plina, deci un client prea rapid e franat, nu ingropat in memorie
+int Enqueue(server *s, request *q) {
+    pthread_mutex_lock(&(*s).lock);
+    while((*s).count == (*s).capacity && !(*s).stopping) {
+        pthread_cond_wait(&(*s).notFull, &(*s).lock);
+    }
+    if((*s).stopping) {
+        pthread_mutex_unlock(&(*s).lock);
+        return -1;
+    }
+    (*s).slot[((*s).head + (*s).count ++) % (*s).capacity] = q;
+    (*s).accepted ++;
+    pthread_cond_signal(&(*s).notEmpty);
+    pthread_mutex_unlock(&(*s).lock);
+    return 0;
+}
 
-    n = (*v).width * (*v).height;
-    r = CallXorshift32(r0, 2 * n);
-    p = DurstenfeldAlgorithm(r, n);
-    pp = Reverse(p, n);
-    w = DecipheredImage(sv, (*v).pixel, r, n);
-    (*v).pixel = Permute(w, pp, n);
+// la oprire, workerii golesc intai coada
+request *Dequeue(server *s) {
+    request *q = NULL;
 
-    free(r);
-    free(p);
-    free(pp);
-    free(w);
+    pthread_mutex_lock(&(*s).lock);
+    while((*s).count == 0 && !(*s).stopping) {
+        pthread_cond_wait(&(*s).notEmpty, &(*s).lock);
+    }
+    if((*s).count > 0) {
+        q = (*s).slot[(*s).head];
+        (*s).head = ((*s).head + 1) % (*s).capacity;
+        (*s).count --;
+        pthread_cond_signal(&(*s).notFull);
+    }
+    pthread_mutex_unlock(&(*s).lock);
+    return q;
 }
 
-void CallDecrypt(char *encryptedImagePath, char *decryptedImagePath, char *SecretKeyPath) {
-    uint32_t r0, sv;
-
-    FILE *in = fopen(SecretKeyPath, "r");
-    fscanf(in, "%u %u", &r0, &sv);
-    fclose(in);
+// latenta se masoara de la intrarea in coada; galeata k numara latentele sub 2^k ms
+void Finish(server *s, request *q, size_t bytes, int failed) {
+    double latency = Now() - (*q).queued;
+    int k = 0;
 
-    imageData v = LoadImage(encryptedImagePath);
-    Decrypt(&v, r0, sv);
-    SaveImage(v, decryptedImagePath);
+    while(k < LATENCY_BUCKETS - 1 && latency * 1e3 >= (double) (1 << k)) {
+        k ++;
+    }
+    pthread_mutex_lock(&(*s).lock);
+    (*s).completed ++;
+    (*s).failed += failed;
+    (*s).bytes += bytes;
+    (*s).latency += latency;
+    (*s).histogram[k] ++;
+    pthread_mutex_unlock(&(*s).lock);
+}
 
-    free(v.pixel);
+// valorile sunt in ordinea R, G, B, ca in PrintStatistics
+int FormatChannels(char *out, size_t size, char const *name, double const *x) {
+    return snprintf(out, size, "\"%s\":[%.6lf,%.6lf,%.6lf]", name, x[2], x[1], x[0]);
 }
 
-void InitialisePixels(pixelRGB f[], pixelRGB *x) {
-    int i;
-    for(i = 0; i < 256; i ++) {
-        f[i].blue = 0;
-        f[i].green = 0;
-        f[i].red = 0;
+void ServeStats(request *q, cryptContext *c) {
+    char const *direction[] = {"horizontal", "vertical", "diagonal"};
+    char text[1024];
+    imageData v, w;
+    imageStats st;
+    size_t k = 0;
+    int d, compared;
+
+    if(ReadImage((*q).job.input, &v, &(*c).scratch.pixel) < 0) {
+        SendReply((*q).from, "%ld error cannot read %s\n", (*q).seq, (*q).job.input);
+        (*q).job.failed = 1;
+        return;
+    }
+    compared = (*q).reference != NULL && ReadImage((*q).reference, &w, NULL) == 0;
+    if(compared && (w.width != v.width || w.height != v.height)) {
+        free(w.pixel);
+        compared = 0;
     }
 
-    (*x).blue = 0;
-    (*x).green = 0;
-    (*x).red = 0;
+    StatsBuffer(c, v.pixel, compared ? w.pixel : NULL, v.width, v.height, &st);
+    k += FormatChannels(text + k, sizeof(text) - k, "chi", st.chi);
+    text[k ++] = ',';
+    k += FormatChannels(text + k, sizeof(text) - k, "entropy", st.entropy);
+    for(d = 0; d < 3; d ++) {
+        text[k ++] = ',';
+        k += FormatChannels(text + k, sizeof(text) - k, direction[d], st.correlation[d]);
+    }
+    if(compared) {
+        text[k ++] = ',';
+        k += FormatChannels(text + k, sizeof(text) - k, "npcr", st.npcr);
+        text[k ++] = ',';
+        k += FormatChannels(text + k, sizeof(text) - k, "uaci", st.uaci);
+        free(w.pixel);
+    }
+    text[k] = '\0';
+    SendReply((*q).from, "%ld ok {%s}\n", (*q).seq, text);
+    (*q).job.failed = 0;
+    (*q).job.bytes = 3 * (size_t) v.width * v.height;
 }
 
-void CalcFq(unsigned char const *v, pixelRGB f[], int n) {
-    int i, poz = 0;
-    for(i = 0; i < n; i ++, poz +=3) {
-        f[v[poz]].blue ++;
-        f[v[poz + 1]].green ++;
-        f[v[poz + 2]].red ++;
+// fiecare worker are contextul lui (memorie refolosita), iar r si p vin din cache-ul comun
+void *ServeWorker(void *arg) {
+    server *s = arg;
+    cryptContext c = {0};
+    request *q;
+
+    InlineTasks((*s).workers > 1);
+    UseCache(&c, (*s).cache);
+    while((q = Dequeue(s)) != NULL) {
+        if((*q).job.mode == 's') {
+            ServeStats(q, &c);
+        } else {
+            RunJob(&(*q).job, (*s).m, (*s).lowMemory, &c);
+            if((*q).job.failed)
+                SendReply((*q).from, "%ld error cannot %s %s\n", (*q).seq, (*q).job.mode == 'e' ? "encrypt" : "decrypt",
+                          (*q).job.input);
+            else
+                SendReply((*q).from, "%ld ok %zu %.3lf\n", (*q).seq, (*q).job.bytes, 1e3 * (*q).job.seconds);
+        }
+        Finish(s, q, (*q).job.failed ? 0 : (*q).job.bytes, (*q).job.failed);
+        ReleaseConnection((*q).from);
+        FreeRequest(q);
     }
+
+    FreeContext(&c);
+    return NULL;
 }
 
-void CalcChi(pixelRGB f[], pixelRGB *x, double f_med) {
+void ServeStatus(server *s, connection *from, long seq) {
+    char text[1024];
+    size_t k;
+    double uptime;
     int i;
-    for(i = 0; i < 256; i ++) {
-        (*x).blue += ((f[i].blue - f_med) * (f[i].blue - f_med) / f_med);
-        (*x).green += ((f[i].green - f_med) * (f[i].green - f_med) / f_med);
-        (*x).red += ((f[i].red - f_med) * (f[i].red - f_med) / f_med);
+
+    pthread_mutex_lock(&(*s).lock);
+    uptime = Now() - (*s).started;
+    k = snprintf(text, sizeof(text), "{\"uptime_s\":%.3lf,\"workers\":%d,\"queue_depth\":%d,\"queue_capacity\":%d,"
+                 "\"accepted\":%lu,\"completed\":%lu,\"failed\":%lu,\"mb\":%.3lf,\"mb_per_s\":%.3lf,"
+                 "\"mean_latency_ms\":%.3lf,\"cache\":{\"hits\":%lu,\"disk_hits\":%lu,\"misses\":%lu,\"evictions\":%lu},"
+                 "\"latency_ms\":{\"below\":[", uptime, (*s).workers, (*s).count, (*s).capacity, (*s).accepted,
+                 (*s).completed, (*s).failed, (*s).bytes / 1e6, (*s).bytes / 1e6 / uptime,
+                 (*s).completed > 0 ? 1e3 * (*s).latency / (*s).completed : 0, (*(*s).cache).hits, (*(*s).cache).diskHits,
+                 (*(*s).cache).misses, (*(*s).cache).evictions);
+    for(i = 0; i < LATENCY_BUCKETS; i ++) {
+        if(i < LATENCY_BUCKETS - 1)
+            k += snprintf(text + k, sizeof(text) - k, "%s%d", i > 0 ? "," : "", 1 << i);
+        else
+            k += snprintf(text + k, sizeof(text) - k, ",null],\"count\":[");
+    }
+    for(i = 0; i < LATENCY_BUCKETS; i ++) {
+        k += snprintf(text + k, sizeof(text) - k, "%s%lu", i > 0 ? "," : "", (*s).histogram[i]);
     }
+    pthread_mutex_unlock(&(*s).lock);
+    SendReply(from, "%ld ok %s]}}\n", seq, text);
 }
 
-void ChiSquaredTest(char *imagePath) {
-    pixelRGB f[256], x;
-    imageData v = LoadImage(imagePath);
-    double t = 256, f_med = (double) v.width * (double) v.height / t;
+int OpenSocket(char *socketPath, struct sockaddr_un *address) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
 
-    InitialisePixels(f, &x);
-    CalcFq(v.pixel, f, v.width * v.height);
-    CalcChi(f, &x, f_med);
+    memset(address, 0, sizeof(struct sockaddr_un));
+    (*address).sun_family = AF_UNIX;
+    if(fd < 0 || strlen(socketPath) >= sizeof((*address).sun_path)) {
+        fprintf(stderr, "%s: cannot open socket\n", socketPath);
+        exit(EXIT_FAILURE);
+    }
+    strcpy((*address).sun_path, socketPath);
+    return fd;
+}
 
-    printf("Chi-squared test on RGB channels for %s:\nR:%.2lf\nG:%.2lf\nB:%.2lf\n", imagePath, x.red, x.green, x.blue);
+// accept nu se intoarce la inchiderea socket-ului, asa ca bucla din Serve e trezita cu o conexiune goala
+void StopServer(server *s) {
+    struct sockaddr_un address;
+    int fd, wake;
+
+    pthread_mutex_lock(&(*s).lock);
+    wake = !(*s).stopping;
+    (*s).stopping = 1;
+    pthread_cond_broadcast(&(*s).notEmpty);
+    pthread_cond_broadcast(&(*s).notFull);
+    pthread_mutex_unlock(&(*s).lock);
+
+    if(wake) {
+        fd = OpenSocket((*s).socketPath, &address);
+        connect(fd, (struct sockaddr *) &address, sizeof(address));
+        close(fd);
+    }
+}
 
-    free(v.pixel);
+void OpenReader(server *s, connection *from) {
+    pthread_mutex_lock(&(*s).lock);
+    (*from).prev = NULL;
+    (*from).next = (*s).open;
+    if((*s).open != NULL)
+        (*(*s).open).prev = from;
+    (*s).open = from;
+    pthread_mutex_unlock(&(*s).lock);
 }
 
-void TaskI(char *imagePath) {
-    char secretKeyPath[101], encryptedImagePath[101];
+void CloseReader(server *s, connection *from) {
+    pthread_mutex_lock(&(*s).lock);
+    if((*from).prev != NULL)
+        (*(*from).prev).next = (*from).next;
+    else
+        (*s).open = (*from).next;
+    if((*from).next != NULL)
+        (*(*from).next).prev = (*from).prev;
+    if((*s).open == NULL)
+        pthread_cond_signal(&(*s).idle);
+    pthread_mutex_unlock(&(*s).lock);
+}
 
-    printf("Numele fisierului care contine imaginea initiala: ");
-    fgets(imagePath, 101, stdin);   imagePath[strlen(imagePath) - 1] = '\0';
+// cititorii inca blocati in getline primesc sfarsit de fisier; Serve nu se intoarce cat timp ei mai folosesc
+// serverul si cache-ul
+void WaitReaders(server *s) {
+    connection *from;
 
-    printf("Numele fisierului care va contine imaginea criptata : ");
-    fgets(encryptedImagePath, 101, stdin);  encryptedImagePath[strlen(encryptedImagePath) - 1] = '\0';
+    pthread_mutex_lock(&(*s).lock);
+    for(from = (*s).open; from != NULL; from = (*from).next) {
+        shutdown((*from).fd, SHUT_RD);
+    }
+    while((*s).open != NULL) {
+        pthread_cond_wait(&(*s).idle, &(*s).lock);
+    }
+    pthread_mutex_unlock(&(*s).lock);
+}
 
-    printf("Numele fisierului care contine cheia secreta : ");
-    fgets(secretKeyPath, 101, stdin);   secretKeyPath[strlen(secretKeyPath) - 1] = '\0';
+// o linie = o cerere: e|d <imagine> <rezultat> <cheie>, stats <imagine> [referinta], status sau quit;
+// raspunsurile incep cu numarul liniei, pentru ca cererile trimise una dupa alta se pot termina in alta ordine
+void *ServeConnection(void *arg) {
+    connection *from = arg;
+    server *s = (*from).s;
+    FILE *in = fdopen(dup((*from).fd), "r");
+    char *line = NULL, *word[4];
+    size_t cap = 0;
+    long seq = 0;
+    request *q;
+    int k;
+
+    while(in != NULL && getline(&line, &cap, in) >= 0) {
+        seq ++;
+        word[0] = strtok(line, " \t\r\n");
+        for(k = 1; k < 4; k ++) {
+            word[k] = strtok(NULL, " \t\r\n");
+        }
+        if(word[0] == NULL)
+            continue;
+
+        if(strcmp(word[0], "status") == 0) {
+            ServeStatus(s, from, seq);
+            continue;
+        }
+        if(strcmp(word[0], "quit") == 0) {
+            SendReply(from, "%ld ok\n", seq);
+            StopServer(s);
+            break;
+        }
+        if(!((strcmp(word[0], "e") == 0 || strcmp(word[0], "d") == 0) && word[3] != NULL) &&
+           !(strcmp(word[0], "stats") == 0 && word[1] != NULL)) {
+            SendReply(from, "%ld error expected \"e|d <input> <output> <key>\", \"stats <image> [reference]\", "
+                      "\"status\" or \"quit\"\n", seq);
+            continue;
+        }
 
-    CallEncrypt(imagePath, encryptedImagePath, secretKeyPath);
+        q = calloc(1, sizeof(request));
+        (*q).from = from;
+        (*q).seq = seq;
+        (*q).job.mode = word[0][0];
+        (*q).job.input = strdup(word[1]);
+        if((*q).job.mode == 's') {
+            (*q).reference = word[2] != NULL ? strdup(word[2]) : NULL;
+        } else {
+            (*q).job.output = strdup(word[2]);
+            (*q).job.key = strdup(word[3]);
+        }
+        (*q).queued = Now();
+
+        pthread_mutex_lock(&(*from).lock);
+        (*from).pending ++;
+        pthread_mutex_unlock(&(*from).lock);
+        if(Enqueue(s, q) < 0) {
+            SendReply(from, "%ld error shutting down\n", seq);
+            ReleaseConnection(from);
+            FreeRequest(q);
+            break;
+        }
+    }
+
+    free(line);
+    if(in != NULL)
+        fclose(in);
+    CloseReader(s, from);
+    ReleaseConnection(from);
+    return NULL;
 }
 
-void TaskII(char *encryptedImagePath) {
-    char secretKeyPath[101], decryptedImagePath[101];
+// --serve: proces de durata care pastreaza firele, memoria si cache-ul de chei intre cereri
+int Serve(char *socketPath, int workers, int capacity, cryptMode m, int lowMemory, keyCache *k) {
+    server s = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+    pthread_t *thread = malloc(max(workers, 1) * sizeof(pthread_t)), reader;
+    struct sockaddr_un address;
+    connection *from;
+    int i, fd, stopping;
+
+    s.slot = malloc(max(capacity, 1) * sizeof(request *));
+    s.capacity = max(capacity, 1);
+    s.workers = max(workers, 1);
+    s.lowMemory = lowMemory;
+    s.m = m;
+    s.cache = k;
+    s.started = Now();
+    s.socketPath = socketPath;
+
+    s.listenFd = OpenSocket(socketPath, &address);
+    unlink(socketPath);
+    if(bind(s.listenFd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(s.listenFd, 64) < 0) {
+        perror(socketPath);
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN);
 
-    printf("Numele fisierului care contine imaginea criptata : ");
-    fgets(encryptedImagePath, 101, stdin);  encryptedImagePath[strlen(encryptedImagePath) - 1] = '\0';
+    for(i = 0; i < s.workers; i ++) {
+        if(pthread_create(thread + i, NULL, ServeWorker, &s) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("Serving on %s with %d workers, queue of %d\n", socketPath, s.workers, s.capacity);
+    fflush(stdout);
+
+    while((fd = accept(s.listenFd, NULL, NULL)) >= 0 || errno == EINTR || errno == ECONNABORTED) {
+        if(fd < 0)
+            continue;
+        // stopping se schimba din firul care primeste quit
+        pthread_mutex_lock(&s.lock);
+        stopping = s.stopping;
+        pthread_mutex_unlock(&s.lock);
+        if(stopping) {
+            close(fd);
+            break;
+        }
+        from = malloc(sizeof(connection));
+        (*from).s = &s;
+        (*from).fd = fd;
+        (*from).pending = 1;
+        pthread_mutex_init(&(*from).lock, NULL);
+        OpenReader(&s, from);
+        if(pthread_create(&reader, NULL, ServeConnection, from) != 0) {
+            CloseReader(&s, from);
+            close(fd);
+            pthread_mutex_destroy(&(*from).lock);
+            free(from);
+            continue;
+        }
+        pthread_detach(reader);
+    }
 
-    printf("Numele fisierului in care va contine imaginea decriptata : ");
-    fgets(decryptedImagePath, 101, stdin);  decryptedImagePath[strlen(decryptedImagePath) - 1] = '\0';
+    // workerii golesc coada; cititorii care mai vin cu cereri primesc "shutting down"
+    StopServer(&s);
+    for(i = 0; i < s.workers; i ++) {
+        pthread_join(thread[i], NULL);
+    }
+    WaitReaders(&s);
+    close(s.listenFd);
+    unlink(socketPath);
+    printf("Served %lu requests, %lu failed, %.1f MB\n", s.completed, s.failed, s.bytes / 1e6);
+    free(s.slot);
+    free(thread);
+    return 0;
+}
 
-    printf("Numele fisierului care contine cheia secreta : ");
-    fgets(secretKeyPath, 101, stdin);   secretKeyPath[strlen(secretKeyPath) - 1] = '\0';
+void *ClientWriter(void *arg) {
+    int fd = *(int *) arg;
+    char buffer[1 << 16];
+    size_t done, size;
+    ssize_t k = 1;
 
-    CallDecrypt(encryptedImagePath, decryptedImagePath, secretKeyPath);
+    while(k > 0 && (size = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+        for(done = 0; done < size && (k = write(fd, buffer + done, size - done)) > 0; done += k) {
+        }
+    }
+    shutdown(fd, SHUT_WR);
+    return NULL;
 }
 
-void TaskIII(char *imagePath, char *encryptedImagePath) {
-    ChiSquaredTest(imagePath);
-    ChiSquaredTest(encryptedImagePath);
+// --client: trimite liniile de la intrare fara sa astepte raspunsurile, apoi afiseaza raspunsurile pe masura ce vin
+int Client(char *socketPath) {
+    struct sockaddr_un address;
+    int fd = OpenSocket(socketPath, &address), failed = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    pthread_t writer;
+    FILE *in;
+
+    if(connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        perror(socketPath);
+        return EXIT_FAILURE;
+    }
+    pthread_create(&writer, NULL, ClientWriter, &fd);
+
+    in = fdopen(dup(fd), "r");
+    while(getline(&line, &cap, in) >= 0) {
+        failed |= strstr(line, " error ") != NULL;
+        fputs(line, stdout);
+    }
+    pthread_join(writer, NULL);
+
+    free(line);
+    fclose(in);
+    close(fd);
+    return failed ? EXIT_FAILURE : 0;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     char imagePath[101], encryptedImagePath[101];
-    TaskI(imagePath);
-    TaskII(encryptedImagePath);
+    cryptMode m = {CIPHER_LEGACY, 0, SHUFFLE_DURSTENFELD};
+    batchJob *job = NULL;
+    char mode = 0, *key = NULL, *cacheDirectory = NULL, *socketPath = NULL;
+    int i, lowMemory = 0, batch = 0, count = 0, threads = 0, failed, bench = 0, benchSizes = 0, cached = 0, capacity = 64;
+    size_t cacheLimit = 1024, diskLimit = 4096;
+    keyCache cache;
+    double sizes[16] = {1, 4, 16};
+    char *end;
+    char const *timer[] = {"Encrypt", "Decrypt", "EncryptInPlace", "DecryptInPlace", NULL}, *counter[] = {NULL};
+
+    PROBE_INIT("encryption", timer, counter);
+    for(i = 1; i < argc; i ++) {
+        // --segmented: modul cu segmente independente, care se poate cripta in paralel
+        if(strcmp(argv[i], "--segmented") == 0) {
+            m.cipher = CIPHER_SEGMENTED;
+            m.segmentLog = SEGMENT_LOG;
+        }
+        // --low-memory: permutare si XOR pe loc, cheia generata pe blocuri
+        if(strcmp(argv[i], "--low-memory") == 0)
+            lowMemory = 1;
+        // --parallel-shuffle: permutarea generata pe galeti, in paralel, in locul lui DurstenfeldAlgorithm
+        if(strcmp(argv[i], "--parallel-shuffle") == 0)
+            m.shuffle = SHUFFLE_BUCKETS;
+        // --bench-permute: Permute/Gather fata de mutarea pixel cu pixel, la 1, 16 si 100 de megapixeli
+        if(strcmp(argv[i], "--bench-permute") == 0) {
+            PermuteBenchmark();
+            return 0;
+        }
+        // --bench [megapixeli...]: timpii fiecarei etape, in JSON; implicit 1, 4 si 16 MP
+        if(strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+            while(i + 1 < argc && benchSizes < 16 && (sizes[benchSizes] = strtod(argv[i + 1], &end)) > 0 && *end == '\0') {
+                benchSizes ++;
+                i ++;
+            }
+            continue;
+        }
+        // --stats imagine [referinta]: statisticile unei imagini, fara criptare
+        if(strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            ChiSquaredTest(argv[i + 1], i + 2 < argc ? argv[i + 2] : NULL);
+            return 0;
+        }
+        // --batch fisier, --encrypt cheie in out..., --decrypt cheie in out...: fara intrebari, pe toate firele
+        if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            ReadManifest(argv[++ i], &job, &count);
+            batch = 1;
+        } else if((strcmp(argv[i], "--encrypt") == 0 || strcmp(argv[i], "--decrypt") == 0) && i + 1 < argc) {
+            mode = argv[i][2];
+            key = argv[++ i];
+            batch = 1;
+        } else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++ i]);
+        // --serve socket [--queue n]: cereri pe un socket Unix; --client socket: cererile de la intrare, raspunsurile la iesire
+        } else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            socketPath = argv[++ i];
+        } else if(strcmp(argv[i], "--queue") == 0 && i + 1 < argc) {
+            capacity = atoi(argv[++ i]);
+        } else if(strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+            return Client(argv[i + 1]);
+        // --key-cache dir, --cache-mb n, --cache-disk-mb n: r si p pastrate intre imagini (si intre rulari, in dir)
+        } else if(strcmp(argv[i], "--key-cache") == 0 && i + 1 < argc) {
+            cacheDirectory = argv[++ i];
+            cached = 1;
+        } else if(strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            cacheLimit = strtoul(argv[++ i], NULL, 10);
+            cached = 1;
+        } else if(strcmp(argv[i], "--cache-disk-mb") == 0 && i + 1 < argc) {
+            diskLimit = strtoul(argv[++ i], NULL, 10);
+        } else if(strncmp(argv[i], "--", 2) != 0) {
+            if(mode == 0 || i + 1 >= argc) {
+                fprintf(stderr, "%s: expected --encrypt or --decrypt with <input> <output> pairs\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            AddJob(&job, &count, mode, argv[i], argv[i + 1], key);
+            i ++;
+        }
+    }
+
+    if(bench) {
+        StageBenchmark(sizes, benchSizes > 0 ? benchSizes : 3, m);
+        return 0;
+    }
+
+    if(cached || socketPath != NULL)
+        InitialiseCache(&cache, cacheLimit << 20, cacheDirectory, diskLimit << 20);
+
+    if(socketPath != NULL) {
+        failed = Serve(socketPath, threads > 0 ? threads : PoolThreads(), capacity, m, lowMemory, &cache);
+        FreeCache(&cache);
+        return failed;
+    }
+
+    if(batch) {
+        failed = RunBatch(job, count, threads > 0 ? threads : PoolThreads(), m, lowMemory, cached ? &cache : NULL);
+        FreeJobs(job, count);
+        if(cached)
+            FreeCache(&cache);
+        return failed > 0 ? EXIT_FAILURE : 0;
+    }
+
+    TaskI(imagePath, m, lowMemory, cached ? &cache : NULL);
+    TaskII(encryptedImagePath, lowMemory, cached ? &cache : NULL);
     TaskIII(imagePath, encryptedImagePath);
+    if(cached) {
+        PrintCache(&cache);
+        FreeCache(&cache);
+    }
     return 0;
 }
@@ -0,0 +1,24 @@
+#!/bin/sh
+# un fisier din --key-cache cu permutarea stricata e ignorat: cheia se regenereaza si criptarea iese la fel
+# rulare: tests/key_cache_corrupt.sh [encryption], din Encryption/; imaginea de test e tabla din Template-Matching
+set -e
+bin=$(cd "$(dirname "${1:-./encryption}")" && pwd)/$(basename "${1:-./encryption}")
+image=$(cd "$(dirname "$0")/../../Template-Matching/input" && pwd)/test.bmp
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+echo "123456789 987654321" > key.txt
+"$bin" --key-cache cache --encrypt key.txt "$image" first.bmp > /dev/null
+file=$(ls cache/*.key)
+# antetul are 24 de octeti, urmat de r (8n octeti) si p (4n octeti); p[5] devine 0x7fffffff
+size=$(wc -c < "$file")
+n=$(( (size - 24) / 12 ))
+printf '\377\377\377\177' | dd of="$file" bs=1 seek=$((24 + 8 * n + 20)) conv=notrunc 2> /dev/null
+
+"$bin" --key-cache cache --encrypt key.txt "$image" second.bmp > out.txt 2>&1 ||
+    { echo "FAIL: encryption with a corrupted cache file failed"; cat out.txt; exit 1; }
+cmp -s first.bmp second.bmp || { echo "FAIL: output differs with a corrupted cache file"; exit 1; }
+"$bin" --key-cache cache --decrypt key.txt second.bmp back.bmp > /dev/null
+cmp -s back.bmp "$image" || { echo "FAIL: decryption through the cache differs from the original"; exit 1; }
+echo "key_cache_corrupt: ok"
@@ -0,0 +1,34 @@
+#!/bin/sh
+# MapImage refuza antetele care nu descriu un BMP de 24 de biti intreg: latime care face stride-ul sa depaseasca
+# 32 de biti, inaltime negativa sau zero, alt numar de biti pe pixel; un BMP mic si corect trece
+# rulare: tests/malformed_bmp.sh [encryption], din Encryption/; cere python3
+set -e
+bin=$(cd "$(dirname "${1:-./encryption}")" && pwd)/$(basename "${1:-./encryption}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+python3 - <<'PY'
+import struct
+
+def save(path, width, height, bits, data):
+    header = b"BM" + struct.pack("<IHHIIiiHHIIiiII", 54 + len(data), 0, 0, 54, 40, width, height, 1, bits, 0,
+                                 len(data), 2835, 2835, 0, 0)
+    open(path, "wb").write(header + data)
+
+save("wrap.bmp", 0x55555556, 1, 24, bytes(64))
+save("negative.bmp", 4, -4, 24, bytes(48))
+save("zero.bmp", 0, 4, 24, bytes(48))
+save("bits.bmp", 4, 4, 32, bytes(64))
+save("good.bmp", 4, 4, 24, bytes(range(48)))
+PY
+
+for name in wrap negative zero bits; do
+    if "$bin" --stats $name.bmp > out.txt 2> err.txt; then
+        echo "FAIL: $name.bmp was accepted"
+        exit 1
+    fi
+    grep -q "^$name.bmp: " err.txt || { echo "FAIL: no error for $name.bmp"; cat out.txt err.txt; exit 1; }
+done
+"$bin" --stats good.bmp > /dev/null || { echo "FAIL: a valid 4x4 BMP was rejected"; exit 1; }
+echo "malformed_bmp: ok"
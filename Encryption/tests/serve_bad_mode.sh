@@ -0,0 +1,39 @@
+#!/bin/sh
+# daemonul raspunde cu error la o imagine cu mod necunoscut in header si serveste in continuare cererile valide
+# rulare: tests/serve_bad_mode.sh [encryption], din Encryption/; imaginea de test e tabla din Template-Matching
+set -e
+bin=$(cd "$(dirname "${1:-./encryption}")" && pwd)/$(basename "${1:-./encryption}")
+image=$(cd "$(dirname "$0")/../../Template-Matching/input" && pwd)/test.bmp
+dir=$(mktemp -d)
+pid=
+trap '[ -n "$pid" ] && kill $pid 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir"
+
+echo "123456789 987654321" > key.txt
+"$bin" --segmented --encrypt key.txt "$image" good.bmp > /dev/null
+# octetii 6-7 din header: marcajul 'X' si cifrul 9, care nu exista
+cp good.bmp bad.bmp
+printf 'X\011' | dd of=bad.bmp bs=1 seek=6 conv=notrunc 2> /dev/null
+
+"$bin" --serve "$dir/enc.sock" --threads 2 > serve.log 2>&1 &
+pid=$!
+i=0
+while [ ! -S enc.sock ] && [ $i -lt 100 ]; do
+    sleep 0.05
+    i=$((i + 1))
+done
+
+echo "d $dir/bad.bmp $dir/bad_out.bmp $dir/key.txt" | "$bin" --client enc.sock > bad.txt || true
+grep -q "^1 error" bad.txt || { echo "FAIL: no error reply for a malformed mode"; cat bad.txt serve.log; exit 1; }
+[ ! -e bad_out.bmp ] || { echo "FAIL: output written for a malformed mode"; exit 1; }
+kill -0 $pid || { echo "FAIL: daemon exited"; cat serve.log; exit 1; }
+
+echo "d $dir/good.bmp $dir/good_out.bmp $dir/key.txt" | "$bin" --client enc.sock > good.txt \
+    || { echo "FAIL: valid request after the malformed one"; cat good.txt; exit 1; }
+cmp -s good_out.bmp "$image" || { echo "FAIL: decrypted image differs"; exit 1; }
+
+echo quit | "$bin" --client enc.sock > /dev/null
+wait $pid
+pid=
+[ ! -e enc.sock ] || { echo "FAIL: socket left behind"; exit 1; }
+echo "serve_bad_mode: ok"
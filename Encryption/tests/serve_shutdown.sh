@@ -0,0 +1,53 @@
+#!/bin/sh
+# la quit, daemonul asteapta si conexiunile care nu mai trimit nimic: cititorii lor sunt treziti, iar serverul si
+# cache-ul se elibereaza abia dupa ce s-au oprit toti
+# rulare: tests/serve_shutdown.sh [encryption], din Encryption/; imaginea de test e tabla din Template-Matching;
+# cere python3
+set -e
+bin=$(cd "$(dirname "${1:-./encryption}")" && pwd)/$(basename "${1:-./encryption}")
+image=$(cd "$(dirname "$0")/../../Template-Matching/input" && pwd)/test.bmp
+dir=$(mktemp -d)
+pid=
+idle=
+trap '[ -n "$pid" ] && kill $pid 2>/dev/null; [ -n "$idle" ] && kill $idle 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir"
+
+echo "123456789 987654321" > key.txt
+"$bin" --serve "$dir/enc.sock" --threads 2 > serve.log 2>&1 &
+pid=$!
+i=0
+while [ ! -S enc.sock ] && [ $i -lt 100 ]; do
+    sleep 0.05
+    i=$((i + 1))
+done
+
+# o conexiune care trimite o cerere si apoi tace cat timp daemonul se opreste (--client trimite doar la sfarsitul
+# intrarii, deci conexiunea e tinuta din python3)
+python3 - "$dir" "$image" <<'PY' &
+import socket, sys, time
+c = socket.socket(socket.AF_UNIX)
+c.connect(sys.argv[1] + "/enc.sock")
+c.sendall(("e %s %s/out.bmp %s/key.txt\n" % (sys.argv[2], sys.argv[1], sys.argv[1])).encode())
+open(sys.argv[1] + "/idle.txt", "wb").write(c.recv(100))
+time.sleep(10)
+PY
+idle=$!
+i=0
+while [ ! -s idle.txt ] && [ $i -lt 100 ]; do
+    sleep 0.05
+    i=$((i + 1))
+done
+grep -q "^1 ok" idle.txt || { echo "FAIL: no reply on the idle connection"; cat idle.txt serve.log; exit 1; }
+
+echo quit | "$bin" --client enc.sock > quit.txt
+i=0
+while kill -0 $pid 2> /dev/null && [ $i -lt 60 ]; do
+    sleep 0.05
+    i=$((i + 1))
+done
+kill -0 $pid 2> /dev/null && { echo "FAIL: daemon still running with an idle connection open"; exit 1; }
+wait $pid || { echo "FAIL: daemon exited with an error"; cat serve.log; exit 1; }
+pid=
+grep -q "^Served 1 requests" serve.log || { echo "FAIL: no shutdown summary"; cat serve.log; exit 1; }
+[ ! -e enc.sock ] || { echo "FAIL: socket left behind"; exit 1; }
+echo "serve_shutdown: ok"
@@ -1,111 +1,208 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "bmpio.h"
+#include "pool.h"
+#include "probe.h"
 
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #define max(a, b) (((a) > (b)) ? (a) : (b))
-#define x_size 11
-#define y_size 15
+// pragul de corelatie peste care o fereastra e detectie
+#ifndef MATCH_PS
+#define MATCH_PS 0.5
+#endif
+// de la aceasta arie a sablonului, produsele pe ferestre se calculeaza prin FFT in loc de direct
+#ifndef FFT_MIN_AREA
+#define FFT_MIN_AREA 400
+#endif
+#define DIRECT_MAX_AREA 66051
+// cel mai mare sablon acceptat: N * suma patratelor si N * sum(I * T) trebuie sa incapa in int64_t
+#define TEMPLATE_MAX_AREA (1 << 23)
+
+// pragul relaxat cu care o fereastra de pe un nivel mic al piramidei e rafinata pe nivelul urmator; in plus, deviatia
+// ferestrei trebuie sa fie macar PYRAMID_CONTRAST din cea a sablonului (zgomotul unei zone goale trece usor de prag
+// pe sabloane mici, dar nu are contrast)
+#ifndef PYRAMID_PS
+#define PYRAMID_PS 0.3
+#endif
+#ifndef PYRAMID_CONTRAST
+#define PYRAMID_CONTRAST 0.15
+#endif
+
+// in modul cascada sablonul se imparte in parti de atatea randuri: marginea scorului se calculeaza pe parti, iar
+// produsele intai pe partile din prima jumatate a sablonului, apoi parte cu parte
+#ifndef CASCADE_ROWS
+#define CASCADE_ROWS 3
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// timerele si contoarele proprii, dupa cele comune din probe.h; numele lor sunt date la PROBE_INIT, in main
+#define PROBE_TEMPLATE_MATCHING (PROBE_COMMON_TIMERS + 0)
+#define PROBE_IMAGE_SLIDE (PROBE_COMMON_TIMERS + 1)
+#define PROBE_IMAGE_SLIDE_FFT (PROBE_COMMON_TIMERS + 2)
+#define PROBE_NON_MAX_REMOVAL (PROBE_COMMON_TIMERS + 3)
+#define PROBE_PERIMETER_DRAW (PROBE_COMMON_TIMERS + 4)
+
+#define PROBE_WINDOWS (PROBE_COMMON_COUNTERS + 0)
+#define PROBE_DETECTIONS (PROBE_COMMON_COUNTERS + 1)
+#define PROBE_NMS_COMPARISONS (PROBE_COMMON_COUNTERS + 2)
 
 typedef struct {
     double blue, green, red;
 } pixelRGB;
 
+// imaginea in tonuri de gri, un octet pe pixel, randurile de sus in jos
 typedef struct {
-    unsigned int height, width, padding;
-    unsigned char header[54];
+    unsigned int height, width;
     unsigned char *pixel;
-} imageData;
+} grayImage;
 
+// x, y e centrul ferestrei (pentru latimi pare, coloana din dreapta mijlocului)
 typedef struct {
-    unsigned int x, y;
+    unsigned int x, y, width, height;
     double corr;
     pixelRGB c;
 } window;
 
+// o cifra plantata pe un board sintetic, cu centrul si dimensiunile ca la window si culoarea sablonului ei
 typedef struct {
-    imageData v;
-    window f;
-    double med, dev;
-} corrData;
-
-void FindHeader(FILE *in, imageData *v) {
-    int i;
-    for(i = 0; i < 54; i ++) {
-        fread(&(*v).header[i], 1, 1, in);
-    }
-
-    fseek(in, 18, SEEK_SET);
-    fread(&(*v).width, sizeof(unsigned int), 1, in);
-    fread(&(*v).height, sizeof(unsigned int), 1, in);
-}
-
-void FindPadding(imageData *v) {
-    if((*v).width % 4 != 0)
-        (*v).padding = 4 - (3 * (*v).width) % 4;
-    else
-        (*v).padding = 0;
-}
+    unsigned int x, y, width, height;
+    pixelRGB c;
+} plantedDigit;
 
-void FindPixels(FILE *in, imageData *v) {
-    (*v).pixel = (unsigned char*) malloc(3 * (*v).height * (*v).width * sizeof(unsigned char));
+// sumele pe prefixe ale imaginii si ale patratelor, (width + 1) x (height + 1) valori. sum se aduna modulo 2^32,
+// dar diferenta pe o fereastra e exacta, pentru ca suma reala a unei ferestre de cel mult TEMPLATE_MAX_AREA pixeli
+// incape in 32 de biti; suma patratelor nu incape peste DIRECT_MAX_AREA pixeli, deci square e pe 64 de biti
+typedef struct {
+    unsigned int height, width;
+    uint32_t *sum;
+    uint64_t *square;
+} integralImage;
 
-    fseek(in, 54, SEEK_SET);
-    int i, j, poz = 0;
+typedef struct {
+    double re, im;
+} complexNumber;
 
-    for(i = 1; i <= (*v).height; i ++) {
-        fseek(in, (- 1) * i * (3 * (*v).width + (*v).padding),SEEK_END);
-        for(j = 0; j < 3 * (*v).width; j ++, poz ++) {
-            fread(&(*v).pixel[poz], 1, 1, in);
-        }
+// blocuri de n x n, n putere a lui 2; twiddle[k] = e^(-2*pi*i*k/n), reverse = permutarea bit-reversal
+typedef struct {
+    size_t n;
+    complexNumber *twiddle;
+    size_t *reverse;
+} fftPlan;
 
-        fseek(in, (*v).padding, SEEK_CUR);
-    }
-}
+typedef struct {
+    grayImage v;
+    integralImage s;
+    window f;
+} corrData;
 
-imageData LoadImage(char *ImagePath) {
-    FILE *in = fopen(ImagePath, "rb");
-    imageData v;
+// sabloanele de aceeasi dimensiune, width x height = area pixeli, intr-un singur bloc: pixelii sablonului t sunt la
+// pixel + t * area, rand dupa rand; sum, variance (area * suma patratelor - sum^2) si culoarea sunt vectori separati
+typedef struct {
+    int count;
+    unsigned int width, height, area;
+    unsigned char *pixel;
+    int64_t *sum, *variance;
+    pixelRGB *c;
+} templateSet;
 
-    FindHeader(in, &v);
-    FindPadding(&v);
-    FindPixels(in, &v);
+// product[k] = suma produselor dintre sablonul de w x h si fereastra care incepe la pixel + k, pentru k < count
+typedef void (*productKernel)(unsigned char const *pixel, unsigned int width, unsigned char const *template,
+                              unsigned int w, unsigned int h, unsigned int count, uint32_t *product);
 
-    fclose(in);
-    return v;
-}
+// kernelii generati pentru sabloanele de width x height; width 0 inseamna orice dimensiune
+typedef struct {
+    unsigned int width, height;
+    productKernel scalar, sse41, avx2;
+} kernelEntry;
 
-void SaveHeader(FILE *out, imageData v) {
-    int i;
-    for(i = 0; i < 54; i ++) {
-        fwrite(&v.header[i], 1, 1, out);
-    }
-}
+// detectiile unui singur sablon; capacitatea se dubleaza
+typedef struct {
+    window *f;
+    unsigned int ct, cap;
+} windowList;
 
-void SavePixels(FILE *out, imageData v) {
-    int i, j, poz = 0;
-    unsigned char c = 0;
-    for (i = v.height - 1; i >= 0; i --) {
-        poz = 3 * i * v.width;
-        for (j = 0; j < 3 * v.width; j ++, poz ++) {
-            fwrite(&v.pixel[poz], 1, 1, out);
-        }
+// spectrele sabloanelor se calculeaza o singura data si sunt doar citite de benzi
+typedef struct {
+    fftPlan p;
+    size_t validX, validY;
+    complexNumber *kernel;
+} fftKernels;
+
+// partea p a sablonului are randurile p * CASCADE_ROWS..(p + 1) * CASCADE_ROWS - 1 (ultima poate fi mai scurta);
+// in sablonul t are suma sum[t * parts + p] si deviation = sqrt(suma patratelor abaterilor de la media ei).
+// Blocul b de produse are randurile end[b - 1]..end[b] - 1 (end[-1] = 0) si kernelul lui; root[t] = sqrt(variance[t])
+typedef struct {
+    unsigned int parts, blocks, *end;
+    productKernel *kernel;
+    double *sum, *deviation, *root;
+} cascadePlan;
 
-        for(j = 0; j < v.padding; j ++) {
-            fwrite(&c, 1, 1, out);
-        }
-    }
-}
+// cautarea e impartita in benzi de randuri; banda k scrie doar in found + k * s.count (si in work + 2 * k, la
+// cascada), deci firele nu se sincronizeaza intre ele, iar listele se lipesc la final in ordinea sabloanelor si a benzilor
+typedef struct {
+    corrData image;
+    templateSet s;
+    double ps;
+    unsigned int rows, band;
+    productKernel kernel;
+    fftKernels const *fft;
+    cascadePlan const *cascade;
+    uint64_t *work;
+    windowList *found;
+} slideJob;
+
+// un nivel al piramidei: board si sabloanele micsorate de 2^l ori; un sablon are width x height pixeli
+typedef struct {
+    grayImage v;
+    integralImage s;
+    unsigned int width, height;
+    unsigned char *pixel;
+    int64_t *sum, *variance;
+} pyramidLevel;
 
-void SaveImage(imageData v, char *NewImagePath) {
-    FILE *out = fopen(NewImagePath, "wb");
+// ferestrele candidate ale unui sablon, dupa coltul din stanga sus: y * coloane + x
+typedef struct {
+    size_t *poz;
+    size_t ct, cap;
+} candidateList;
 
-    SaveHeader(out, v);
-    SavePixels(out, v);
+// ferestrele de pe randul y (coltul de sus) cu coltul din stanga in [first, last)
+typedef struct {
+    unsigned int y, first, last;
+} segment;
 
-    fclose(out);
-}
+typedef struct {
+    pyramidLevel const *level;
+    int levels, count;
+    unsigned int rows, band;
+    candidateList *found;
+    productKernel coarse;
+    corrData image;
+    templateSet s;
+    double ps;
+    productKernel kernel;
+    cascadePlan const *cascade;
+    uint64_t *work;
+    segment *segments;
+    size_t segmentCount;
+    windowList *windows;
+} pyramidJob;
+
+static char *digitPath[10] = {"cifra0.bmp", "cifra1.bmp", "cifra2.bmp", "cifra3.bmp", "cifra4.bmp",
+                              "cifra5.bmp", "cifra6.bmp", "cifra7.bmp", "cifra8.bmp", "cifra9.bmp"};
 
 void InitialiseColors(pixelRGB c[]) {
     c[0].red = 255;    c[0].green = 0;      c[0].blue = 0;      // rosu
@@ -129,166 +226,1284 @@ int cmp(const void *a, const void *b) {
 }
 
 unsigned int CalcStartPoz(imageData v, window f) {
-    unsigned int x_start = x_size / 2;
-    unsigned int y_start = y_size / 2;
+    unsigned int x_start = f.width / 2;
+    unsigned int y_start = f.height / 2;
     unsigned int poz = 3 * (f.y - y_start) * v.width + 3 * (f.x - x_start);
     return poz;
 }
 
-void HorizontalDraw(imageData *v, int poz, pixelRGB c) {
+unsigned int CalcGrayPoz(grayImage v, window f) {
+    return (f.y - f.height / 2) * v.width + (f.x - f.width / 2);
+}
+
+void HorizontalDraw(imageData *v, int poz, unsigned int length, pixelRGB c) {
     int i;
-    for(i = 0; i < x_size; i ++, poz += 3) {
+    for(i = 0; i < length; i ++, poz += 3) {
         (*v).pixel[poz] = (unsigned char) c.blue;
         (*v).pixel[poz + 1] = (unsigned char) c.green;
         (*v).pixel[poz + 2] = (unsigned char) c.red;
     }
 }
 
-void VerticalDraw(imageData *v, int poz, pixelRGB c) {
+void VerticalDraw(imageData *v, int poz, unsigned int length, pixelRGB c) {
     int i;
-    for(i = 0; i < y_size; i ++, poz += 3 * (*v).width) {
+    for(i = 0; i < length; i ++, poz += 3 * (*v).width) {
         (*v).pixel[poz] = (unsigned char) c.blue;
         (*v).pixel[poz + 1] = (unsigned char) c.green;
         (*v).pixel[poz + 2] = (unsigned char) c.red;
     }
 }
 
-void PerimeterDraw(char *imagePath, window f, pixelRGB c) {
-    imageData v = LoadImage(imagePath);
-    unsigned int poz = CalcStartPoz(v, f);
+// ramele se deseneaza direct in imaginea color din memorie, salvata o singura data la final
+void PerimeterDraw(imageData *v, window f, pixelRGB c) {
+    unsigned int poz = CalcStartPoz(*v, f);
+    PROBE_START(start);
 
-    HorizontalDraw(&v, poz, c);
-    HorizontalDraw(&v, poz + 3 * (y_size - 1) * v.width, c);
+    HorizontalDraw(v, poz, f.width, c);
+    HorizontalDraw(v, poz + 3 * (f.height - 1) * (*v).width, f.width, c);
 
-    VerticalDraw(&v, poz, c);
-    VerticalDraw(&v, poz + 3 * (x_size - 1), c);
+    VerticalDraw(v, poz, f.height, c);
+    VerticalDraw(v, poz + 3 * (f.width - 1), f.height, c);
+    PROBE_STOP(PROBE_PERIMETER_DRAW, start);
+}
 
-    SaveImage(v, imagePath);
-    free(v.pixel);
+// o singura conversie, din culorile originale; fisierul nu se modifica
+grayImage Grayscale(imageData v) {
+    grayImage g = {v.height, v.width, malloc((size_t) v.width * v.height)};
+    size_t i, n = (size_t) v.width * v.height;
+
+    for(i = 0; i < n; i ++) {
+        g.pixel[i] = (unsigned char) (0.299 * v.pixel[3 * i + 2] + 0.587 * v.pixel[3 * i + 1] + 0.114 * v.pixel[3 * i]);
+    }
+
+    return g;
 }
 
-void Grayscale(char *imagePath) {
-    imageData v = LoadImage(imagePath);
-    int i, j, poz = 0;
-    unsigned char aux;
+integralImage IntegralImage(grayImage v) {
+    size_t stride = (size_t) v.width + 1, n = stride * (v.height + 1);
+    integralImage s = {v.height, v.width, malloc(n * sizeof(uint32_t)), malloc(n * sizeof(uint64_t))};
+    uint32_t rowSum;
+    uint64_t rowSquare;
+    unsigned int i, j;
+    size_t poz;
 
+    memset(s.sum, 0, stride * sizeof(uint32_t));
+    memset(s.square, 0, stride * sizeof(uint64_t));
     for(i = 0; i < v.height; i ++) {
-        for(j = 0; j < v.width; j ++, poz += 3) {
-            aux = (unsigned char) (0.299 * v.pixel[poz + 2] + 0.587 * v.pixel[poz + 1] + 0.114 * v.pixel[poz]);
-            v.pixel[poz] = v.pixel[poz + 1] = v.pixel[poz + 2] = aux;
+        poz = (i + 1) * stride;
+        s.sum[poz] = s.square[poz] = rowSum = rowSquare = 0;
+        for(j = 0; j < v.width; j ++) {
+            rowSum += v.pixel[(size_t) i * v.width + j];
+            rowSquare += v.pixel[(size_t) i * v.width + j] * v.pixel[(size_t) i * v.width + j];
+            s.sum[poz + j + 1] = s.sum[poz + j + 1 - stride] + rowSum;
+            s.square[poz + j + 1] = s.square[poz + j + 1 - stride] + rowSquare;
         }
     }
 
-    SaveImage(v, imagePath);
-    free(v.pixel);
+    return s;
 }
 
-double CalcMed(imageData v, window f) {
-    unsigned int poz = CalcStartPoz(v, f);
-    double s_med = 0;
-    int i, j;
+void FreeIntegral(integralImage *s) {
+    free((*s).sum);
+    free((*s).square);
+}
+
+// suma si suma patratelor ferestrei centrate in f, din patru citiri fiecare
+void WindowSums(integralImage s, window f, int64_t *sum, int64_t *square) {
+    size_t stride = (size_t) s.width + 1;
+    size_t top = (f.y - f.height / 2) * stride + (f.x - f.width / 2), bottom = top + f.height * stride;
+
+    (*sum) = (uint32_t) (s.sum[bottom + f.width] - s.sum[bottom] - s.sum[top + f.width] + s.sum[top]);
+    (*square) = s.square[bottom + f.width] - s.square[bottom] - s.square[top + f.width] + s.square[top];
+}
+
+// ca WindowSums, pentru un dreptunghi oarecare dat prin coltul din stanga sus
+void RectSums(integralImage s, unsigned int x, unsigned int y, unsigned int w, unsigned int h, int64_t *sum, int64_t *square) {
+    size_t stride = (size_t) s.width + 1, top = y * stride + x, bottom = top + h * stride;
+
+    (*sum) = (uint32_t) (s.sum[bottom + w] - s.sum[bottom] - s.sum[top + w] + s.sum[top]);
+    (*square) = s.square[bottom + w] - s.square[bottom] - s.square[top + w] + s.square[top];
+}
+
+void TemplateStats(templateSet *s, int t) {
+    unsigned char const *pixel = (*s).pixel + t * (*s).area;
+    int64_t sum = 0, square = 0;
+    int i;
+
+    for(i = 0; i < (*s).area; i ++) {
+        sum += pixel[i];
+        square += pixel[i] * pixel[i];
+    }
+
+    (*s).sum[t] = sum;
+    (*s).variance[t] = (int64_t) (*s).area * square - sum * sum;
+}
+
+// fiecare sablon, convertit in tonuri de gri, se foloseste intreg, cu dimensiunile din fisierul lui. Sabloanele de
+// aceeasi dimensiune intra in acelasi set, in ordinea in care sunt date; intoarce numarul de seturi
+int LoadTemplates(templateSet **sets, char *templatePath[], pixelRGB const c[], int count) {
+    grayImage *g = malloc(count * sizeof(grayImage));
+    int *set = malloc(count * sizeof(int));
+    templateSet *s;
+    imageData v;
+    int t, u, n = 0;
+
+    for(t = 0; t < count; t ++) {
+        v = LoadImage(templatePath[t]);
+        if((uint64_t) v.width * v.height > TEMPLATE_MAX_AREA) {
+            fprintf(stderr, "%s: template of %ux%u pixels is larger than %d pixels\n", templatePath[t], v.width,
+                    v.height, TEMPLATE_MAX_AREA);
+            exit(EXIT_FAILURE);
+        }
+        g[t] = Grayscale(v);
+        free(v.pixel);
+
+        set[t] = n;
+        for(u = 0; u < t; u ++) {
+            if(g[u].width == g[t].width && g[u].height == g[t].height) {
+                set[t] = set[u];
+                break;
+            }
+        }
+        if(set[t] == n)
+            n ++;
+    }
 
-    for(i = 0; i < y_size; i ++, poz += 3 * v.width) {
-        for(j = 0; j < x_size; j ++) {
-            s_med += v.pixel[poz + 3 * j];
+    (*sets) = calloc(n, sizeof(templateSet));
+    for(t = 0; t < count; t ++) {
+        s = (*sets) + set[t];
+        if((*s).count == 0) {
+            (*s).width = g[t].width;
+            (*s).height = g[t].height;
+            (*s).area = g[t].width * g[t].height;
+            for(u = t; u < count; u ++) {
+                if(set[u] == set[t])
+                    (*s).count ++;
+            }
+            (*s).pixel = malloc((*s).count * (*s).area);
+            (*s).sum = malloc((*s).count * sizeof(int64_t));
+            (*s).variance = malloc((*s).count * sizeof(int64_t));
+            (*s).c = malloc((*s).count * sizeof(pixelRGB));
+            (*s).count = 0;
         }
+
+        memcpy((*s).pixel + (*s).count * (*s).area, g[t].pixel, (*s).area);
+        (*s).c[(*s).count] = c[t];
+        TemplateStats(s, (*s).count);
+        (*s).count ++;
+        free(g[t].pixel);
     }
 
-    s_med /= (x_size * y_size);
-    return s_med;
+    free(g);
+    free(set);
+    return n;
+}
+
+void FreeTemplates(templateSet *s) {
+    free((*s).pixel);
+    free((*s).sum);
+    free((*s).variance);
+    free((*s).c);
 }
 
-double StandardDeviation(imageData v, window f, double med) {
-    unsigned int poz = CalcStartPoz(v, f);
-    double dev = 0;
+// singurul termen care depinde de ambele imagini: suma produselor intensitatilor
+int64_t CalcCorrSum(corrData image, unsigned char const *template) {
+    int pozImage = CalcGrayPoz(image.v, image.f);
+
+    int64_t corr = 0;
     int i, j;
 
-    for(i = 0; i < y_size; i ++, poz += 3 * v.width) {
-        for(j = 0; j < x_size; j ++) {
-            dev += (v.pixel[poz + 3 * j] - med) * (v.pixel[poz + 3 * j] - med);
+    for(i = 0; i < image.f.height; i ++, pozImage += image.v.width, template += image.f.width) {
+        for(j = 0; j < image.f.width; j ++) {
+            corr += image.v.pixel[pozImage + j] * template[j];
         }
     }
 
-    dev /= (x_size * y_size - 1);
-    dev = sqrt(dev);
-    return dev;
+    return corr;
 }
 
-double CalcCorrSum(corrData image, corrData template) {
-    int pozImage = CalcStartPoz(image.v, image.f);
-    int pozTemplate = CalcStartPoz(template.v, template.f);
+// suma ferestrei si N * suma patratelor - suma^2 (N = pixelii ferestrei), aceleasi pentru toate sabloanele
+void WindowStats(corrData image, int64_t *sum, int64_t *variance) {
+    int64_t square;
 
-    double corr = 0;
-    int i, j, intensityImage, intensityTemplate;
+    WindowSums(image.s, image.f, sum, &square);
+    (*variance) = (int64_t) image.f.width * image.f.height * square - (*sum) * (*sum);
+}
+
+// aceeasi valoare ca media produselor abaterilor impartite la deviatii (cu N - 1 la numitor), scrisa cu sume
+// intregi: (N - 1) * (N * sum(I * T) - sum(I) * sum(T)) / (N * sqrt(varianta(I) * varianta(T)));
+// o fereastra (sau un sablon) uniforma are deviatia 0, corelatia nu e definita si nu poate fi detectie
+double NormalizedCorrelation(int64_t sum, int64_t variance, templateSet const *s, int t, int64_t product) {
+    double n = (*s).area;
+
+    if(variance == 0 || (*s).variance[t] == 0)
+        return 0;
 
-    for(i = 0; i < y_size; i ++, pozImage += 3 * image.v.width, pozTemplate += 3 * template.v.width) {
-        for(j = 0; j < x_size; j ++) {
-            intensityTemplate = template.v.pixel[pozTemplate + 3 * j];
-            intensityImage = image.v.pixel[pozImage + 3 * j];
-            corr += ((intensityImage - image.med) * (intensityTemplate - template.med) / (image.dev * template.dev));
+    return (n - 1) * (double) ((int64_t) (*s).area * product - sum * (*s).sum[t]) /
+           (n * sqrt((double) variance * (*s).variance[t]));
+}
+
+double CrossCorrelation(corrData image, templateSet s, int t) {
+    int64_t sum, variance;
+
+    WindowStats(image, &sum, &variance);
+    return NormalizedCorrelation(sum, variance, &s, t, CalcCorrSum(image, s.pixel + t * s.area));
+}
+
+fftPlan PlanFFT(size_t n) {
+    fftPlan p = {n, malloc(n / 2 * sizeof(complexNumber)), malloc(n * sizeof(size_t))};
+    size_t i, b, bits = 0;
+
+    while(((size_t) 1 << bits) < n)
+        bits ++;
+    for(i = 0; i < n / 2; i ++) {
+        p.twiddle[i].re = cos(2 * M_PI * i / n);
+        p.twiddle[i].im = -sin(2 * M_PI * i / n);
+    }
+    for(i = 0; i < n; i ++) {
+        for(p.reverse[i] = 0, b = 0; b < bits; b ++) {
+            p.reverse[i] |= (i >> b & 1) << (bits - 1 - b);
         }
     }
 
-    return corr;
+    return p;
 }
 
-double CrossCorrelation(corrData image, corrData template) {
-    image.med = CalcMed(image.v, image.f);
-    template.med = CalcMed(template.v, template.f);
+void FreePlan(fftPlan *p) {
+    free((*p).twiddle);
+    free((*p).reverse);
+}
+
+// transformata pe loc, radix 2; inverse foloseste conjugatele, fara impartirea la n
+void FFT(fftPlan p, complexNumber *a, int inverse) {
+    size_t len, i, j, step;
+    complexNumber u, v, w;
+
+    for(i = 0; i < p.n; i ++) {
+        if(i < p.reverse[i]) {
+            u = a[i];
+            a[i] = a[p.reverse[i]];
+            a[p.reverse[i]] = u;
+        }
+    }
 
-    image.dev = StandardDeviation(image.v, image.f, image.med);
-    template.dev = StandardDeviation(template.v, template.f, template.med);
+    for(len = 2; len <= p.n; len <<= 1) {
+        step = p.n / len;
+        for(i = 0; i < p.n; i += len) {
+            for(j = 0; j < len / 2; j ++) {
+                w = p.twiddle[j * step];
+                if(inverse)
+                    w.im = -w.im;
+                u = a[i + j];
+                v.re = a[i + j + len / 2].re * w.re - a[i + j + len / 2].im * w.im;
+                v.im = a[i + j + len / 2].re * w.im + a[i + j + len / 2].im * w.re;
+                a[i + j].re = u.re + v.re;
+                a[i + j].im = u.im + v.im;
+                a[i + j + len / 2].re = u.re - v.re;
+                a[i + j + len / 2].im = u.im - v.im;
+            }
+        }
+    }
+}
 
-    double corr = CalcCorrSum(image, template);
-    corr /= (x_size * y_size);
+// transformata 2D a unui bloc real n x n; pentru ca intrarea e reala se pastreaza doar coloanele 0..n/2
+// (out are n x (n/2 + 1) valori), iar randurile se transforma cate doua, ca parte reala si imaginara
+void RealForward(fftPlan p, double const *in, complexNumber *out, complexNumber *line) {
+    size_t n = p.n, h = n / 2 + 1, r, k;
+    complexNumber z, y;
 
-    return corr;
+    for(r = 0; r < n; r += 2) {
+        for(k = 0; k < n; k ++) {
+            line[k].re = in[r * n + k];
+            line[k].im = in[(r + 1) * n + k];
+        }
+        FFT(p, line, 0);
+        // spectrele celor doua randuri: A = (Z[k] + conj(Z[n - k])) / 2, B = (Z[k] - conj(Z[n - k])) / 2i
+        for(k = 0; k < h; k ++) {
+            z = line[k];
+            y = line[(n - k) % n];
+            out[r * h + k].re = (z.re + y.re) / 2;
+            out[r * h + k].im = (z.im - y.im) / 2;
+            out[(r + 1) * h + k].re = (z.im + y.im) / 2;
+            out[(r + 1) * h + k].im = (y.re - z.re) / 2;
+        }
+    }
+
+    for(k = 0; k < h; k ++) {
+        for(r = 0; r < n; r ++) {
+            line[r] = out[r * h + k];
+        }
+        FFT(p, line, 0);
+        for(r = 0; r < n; r ++) {
+            out[r * h + k] = line[r];
+        }
+    }
+}
+
+// inversa lui RealForward, impartita la n * n; spec se foloseste ca spatiu de lucru
+void RealInverse(fftPlan p, complexNumber *spec, double *out, complexNumber *line) {
+    size_t n = p.n, h = n / 2 + 1, r, k;
+    complexNumber a, b;
+
+    for(k = 0; k < h; k ++) {
+        for(r = 0; r < n; r ++) {
+            line[r] = spec[r * h + k];
+        }
+        FFT(p, line, 1);
+        for(r = 0; r < n; r ++) {
+            spec[r * h + k] = line[r];
+        }
+    }
+
+    // doua randuri reale intr-o singura transformata: Z = A + iB, cu jumatatea lipsa din simetria hermitica
+    for(r = 0; r < n; r += 2) {
+        for(k = 0; k < n; k ++) {
+            a = spec[r * h + min(k, n - k)];
+            b = spec[(r + 1) * h + min(k, n - k)];
+            if(k >= h) {
+                a.im = -a.im;
+                b.im = -b.im;
+            }
+            line[k].re = a.re - b.im;
+            line[k].im = a.im + b.re;
+        }
+        FFT(p, line, 1);
+        for(k = 0; k < n; k ++) {
+            out[r * n + k] = line[k].re / ((double) n * n);
+            out[(r + 1) * n + k] = line[k].im / ((double) n * n);
+        }
+    }
 }
 
-void ImageSlide(corrData image, corrData template, double ps, unsigned int *ct, window **D) {
+// kernelii de produse se genereaza din macro-urile de mai jos: o data generic, cu W = w si H = h date la rulare,
+// si cate o data pentru fiecare dimensiune din KERNEL_SIZES, cu W si H constante, ca buclele pe sablon sa se desfaca
+// complet. Toti au aceeasi semnatura (productKernel), deci SelectKernel ii alege dintr-un tabel.
+// Sumele incap in 32 de biti cat timp aria sablonului e cel mult DIRECT_MAX_AREA = 2^32 / (255 * 255)
+#define PRODUCTS_SCALAR(name, W, H) \
+void name(unsigned char const *pixel, unsigned int width, unsigned char const *template, unsigned int w, \
+          unsigned int h, unsigned int count, uint32_t *product) { \
+    unsigned int k, i, j; \
+    uint32_t corr; \
+\
+    for(k = 0; k < count; k ++) { \
+        corr = 0; \
+        for(i = 0; i < (H); i ++) { \
+            for(j = 0; j < (W); j ++) { \
+                corr += pixel[i * width + k + j] * template[i * (W) + j]; \
+            } \
+        } \
+        product[k] = corr; \
+    } \
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// acelasi rezultat ca PRODUCTS_SCALAR, pentru 16 ferestre alaturate odata. Coloanele sablonului se iau cate doua:
+// octetii ferestrelor de la coloanele j si j + 1 se intercaleaza pe 16 biti, iar madd aduna b[j] * t[j] + b[j + 1] * t[j + 1]
+// pe 32 de biti (toate valorile sunt sub 256, deci nu conteaza ca instructiunea lucreaza cu semn). Unpack lucreaza
+// pe jumatati de 128 de biti, asa ca low tine ferestrele 0-3 si 8-11, iar high 4-7 si 12-15, reordonate la final
+#define PRODUCTS_AVX2(name, tail, W, H) \
+__attribute__((target("avx2"))) \
+void name(unsigned char const *pixel, unsigned int width, unsigned char const *template, unsigned int w, \
+          unsigned int h, unsigned int count, uint32_t *product) { \
+    unsigned int k, i, j; \
+    unsigned char const *row; \
+    __m256i low, high, a, b, t; \
+\
+    for(k = 0; k + 16 <= count; k += 16) { \
+        low = high = _mm256_setzero_si256(); \
+        for(i = 0; i < (H); i ++) { \
+            row = pixel + i * width + k; \
+            for(j = 0; j < (W); j += 2) { \
+                a = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *) (row + j))); \
+                if(j + 1 < (W)) { \
+                    b = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *) (row + j + 1))); \
+                    t = _mm256_set1_epi32(template[i * (W) + j] | template[i * (W) + j + 1] << 16); \
+                } else { \
+                    b = a; \
+                    t = _mm256_set1_epi32(template[i * (W) + j]); \
+                } \
+                low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), t)); \
+                high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), t)); \
+            } \
+        } \
+        _mm256_storeu_si256((__m256i *) (product + k), _mm256_permute2x128_si256(low, high, 0x20)); \
+        _mm256_storeu_si256((__m256i *) (product + k + 8), _mm256_permute2x128_si256(low, high, 0x31)); \
+    } \
+\
+    if(k < count) \
+        tail(pixel + k, width, template, w, h, count - k, product + k); \
+}
+
+// la fel, cate 8 ferestre; pe 128 de biti low si high sunt direct ferestrele 0-3 si 4-7
+#define PRODUCTS_SSE41(name, tail, W, H) \
+__attribute__((target("sse4.1"))) \
+void name(unsigned char const *pixel, unsigned int width, unsigned char const *template, unsigned int w, \
+          unsigned int h, unsigned int count, uint32_t *product) { \
+    unsigned int k, i, j; \
+    unsigned char const *row; \
+    __m128i low, high, a, b, t; \
+\
+    for(k = 0; k + 8 <= count; k += 8) { \
+        low = high = _mm_setzero_si128(); \
+        for(i = 0; i < (H); i ++) { \
+            row = pixel + i * width + k; \
+            for(j = 0; j < (W); j += 2) { \
+                a = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const *) (row + j))); \
+                if(j + 1 < (W)) { \
+                    b = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const *) (row + j + 1))); \
+                    t = _mm_set1_epi32(template[i * (W) + j] | template[i * (W) + j + 1] << 16); \
+                } else { \
+                    b = a; \
+                    t = _mm_set1_epi32(template[i * (W) + j]); \
+                } \
+                low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), t)); \
+                high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), t)); \
+            } \
+        } \
+        _mm_storeu_si128((__m128i *) (product + k), low); \
+        _mm_storeu_si128((__m128i *) (product + k + 4), high); \
+    } \
+\
+    if(k < count) \
+        tail(pixel + k, width, template, w, h, count - k, product + k); \
+}
+
+#define PRODUCT_KERNELS(W, H) \
+    PRODUCTS_SCALAR(ProductsScalar##W##x##H, W, H) \
+    PRODUCTS_AVX2(ProductsAVX2##W##x##H, ProductsScalar##W##x##H, W, H) \
+    PRODUCTS_SSE41(ProductsSSE41##W##x##H, ProductsScalar##W##x##H, W, H)
+#define KERNEL_ENTRY(W, H) {W, H, ProductsScalar##W##x##H, ProductsSSE41##W##x##H, ProductsAVX2##W##x##H},
+#else
+#define PRODUCT_KERNELS(W, H) PRODUCTS_SCALAR(ProductsScalar##W##x##H, W, H)
+#define KERNEL_ENTRY(W, H) {W, H, ProductsScalar##W##x##H, NULL, NULL},
+#endif
+
+// cifrele din input (11 x 15), nivelul lor din piramida (5 x 7) si cateva dimensiuni patrate
+#define KERNEL_SIZES(X) X(11, 15) X(5, 7) X(8, 8) X(16, 16)
+
+PRODUCTS_SCALAR(ProductsScalar, w, h)
+#if defined(__x86_64__) || defined(__i386__)
+PRODUCTS_AVX2(ProductsAVX2, ProductsScalar, w, h)
+PRODUCTS_SSE41(ProductsSSE41, ProductsScalar, w, h)
+#endif
+KERNEL_SIZES(PRODUCT_KERNELS)
+
+// ultima intrare (0 x 0) e varianta generica
+static kernelEntry const kernelTable[] = {
+    KERNEL_SIZES(KERNEL_ENTRY)
+#if defined(__x86_64__) || defined(__i386__)
+    {0, 0, ProductsScalar, ProductsSSE41, ProductsAVX2}
+#else
+    {0, 0, ProductsScalar, NULL, NULL}
+#endif
+};
+
+// kernelul pentru sabloane de w x h: cel generat pentru dimensiunea lor sau cel generic, cu cel mai larg set de
+// instructiuni pe care il are procesorul; TM_KERNEL=scalar|sse4.1|avx2 il poate cobori, alta valoare e semnalata o data
+// si ignorata
+productKernel SelectKernel(unsigned int w, unsigned int h, char const **name) {
+    static int warned;
+    char const *wanted = getenv("TM_KERNEL");
+    kernelEntry const *e = kernelTable;
+    productKernel kernel;
+
+    while((*e).width != 0 && ((*e).width != w || (*e).height != h))
+        e ++;
+
+    if(wanted != NULL && strcmp(wanted, "avx2") != 0 && strcmp(wanted, "sse4.1") != 0 && strcmp(wanted, "scalar") != 0) {
+        if(!warned)
+            fprintf(stderr, "TM_KERNEL=%s: unknown kernel (avx2, sse4.1 or scalar), using the detected one\n", wanted);
+        warned = 1;
+        wanted = NULL;
+    }
+
+    (*name) = (*e).width != 0 ? "scalar" : "scalar, generic";
+    kernel = (*e).scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && (wanted == NULL || strcmp(wanted, "avx2") == 0)) {
+        (*name) = (*e).width != 0 ? "avx2" : "avx2, generic";
+        kernel = (*e).avx2;
+    } else if(__builtin_cpu_supports("sse4.1") && (wanted == NULL || strcmp(wanted, "scalar") != 0)) {
+        (*name) = (*e).width != 0 ? "sse4.1" : "sse4.1, generic";
+        kernel = (*e).sse41;
+    }
+#endif
+    PROBE_NOTE("kernel", *name);
+    return kernel;
+}
+
+void AddWindow(windowList *l, window f, double corr, pixelRGB c) {
+    if((*l).ct == (*l).cap) {
+        (*l).cap = 2 * (*l).cap + 16;
+        (*l).f = realloc((*l).f, (*l).cap * sizeof(window));
+        PROBE_COUNT(PROBE_REALLOC, 1);
+    }
+    PROBE_COUNT(PROBE_DETECTIONS, 1);
+    (*l).f[(*l).ct] = f;
+    (*l).f[(*l).ct].corr = corr;
+    (*l).f[(*l).ct].c = c;
+    (*l).ct ++;
+}
+
+// fiecare fereastra e comparata cu toate sabloanele cat timp e inca in cache; found are cate o lista pe sablon
+// produsele se calculeaza pe tot segmentul cu kernel, iar normalizarea o data pe fereastra. product are loc
+// pentru s.count * (last - first) valori
+void SegmentSlide(corrData image, templateSet s, double ps, windowList *found, productKernel kernel, segment g,
+                  uint32_t *product) {
+    unsigned int count = g.last - g.first, k;
+    int64_t sum, variance;
     double corr = 0;
+    int t;
+
+    for(t = 0; t < s.count; t ++) {
+        kernel(image.v.pixel + (size_t) g.y * image.v.width + g.first, image.v.width, s.pixel + t * s.area,
+               s.width, s.height, count, product + t * count);
+    }
+    PROBE_COUNT(PROBE_WINDOWS, (uint64_t) count * s.count);
+
+    image.f.width = s.width;
+    image.f.height = s.height;
+    image.f.y = g.y + s.height / 2;
+    for(k = 0; k < count; k ++) {
+        image.f.x = g.first + k + s.width / 2;
+        WindowStats(image, &sum, &variance);
+        if(variance == 0)
+            continue;
+
+        for(t = 0; t < s.count; t ++) {
+            corr = NormalizedCorrelation(sum, variance, &s, t, product[t * count + k]);
+            if(corr > ps)
+                AddWindow(found + t, image.f, corr, s.c[t]);
+        }
+    }
+}
+
+cascadePlan PrepareCascade(templateSet s) {
+    unsigned int start = min(max((s.height / 2 + CASCADE_ROWS - 1) / CASCADE_ROWS, 1) * CASCADE_ROWS, s.height), b, p, i, n;
+    unsigned char const *pixel;
+    double sum, square;
+    char const *name;
+    cascadePlan c;
+    int t;
+
+    c.parts = (s.height + CASCADE_ROWS - 1) / CASCADE_ROWS;
+    c.blocks = 1 + (s.height - start + CASCADE_ROWS - 1) / CASCADE_ROWS;
+    c.end = malloc(c.blocks * sizeof(unsigned int));
+    c.kernel = malloc(c.blocks * sizeof(productKernel));
+    c.sum = malloc(s.count * c.parts * sizeof(double));
+    c.deviation = malloc(s.count * c.parts * sizeof(double));
+    c.root = malloc(s.count * sizeof(double));
+
+    for(b = 0; b < c.blocks; b ++) {
+        c.end[b] = min(start + b * CASCADE_ROWS, s.height);
+        c.kernel[b] = SelectKernel(s.width, c.end[b] - (b > 0 ? c.end[b - 1] : 0), &name);
+    }
+    for(t = 0; t < s.count; t ++) {
+        c.root[t] = sqrt((double) s.variance[t]);
+        for(p = 0; p < c.parts; p ++) {
+            pixel = s.pixel + t * s.area + p * CASCADE_ROWS * s.width;
+            n = (min((p + 1) * CASCADE_ROWS, s.height) - p * CASCADE_ROWS) * s.width;
+            sum = square = 0;
+            for(i = 0; i < n; i ++) {
+                sum += pixel[i];
+                square += pixel[i] * pixel[i];
+            }
+            c.sum[t * c.parts + p] = sum;
+            c.deviation[t * c.parts + p] = sqrt(max(square - sum * sum / n, 0));
+        }
+    }
+
+    return c;
+}
+
+// memoria lui CascadeSlide pentru o banda: media, deviatia si marginea pe parti, pentru 16 ferestre; ultimul rand
+// din margine ramane 0. NULL fara cascada
+double *CascadeBuffer(cascadePlan const *c) {
+    return c != NULL ? calloc(16 * (3 * (*c).parts + 1), sizeof(double)) : NULL;
+}
+
+void FreeCascade(cascadePlan *c) {
+    free((*c).end);
+    free((*c).kernel);
+    free((*c).sum);
+    free((*c).deviation);
+    free((*c).root);
+}
+
+// aceleasi detectii, cu aceleasi scoruri, ca SegmentSlide, dar ferestrele care nu mai pot trece de prag sunt
+// abandonate pe parcurs. Pe o parte a sablonului cu n pixeli, R = suma ei din fereastra si Ts = cea din sablon,
+// sum(I * T) = R * Ts / n + sum((I - R / n) * (T - Ts / n)) <= R * Ts / n + deviatie(I) * deviatie(T)
+// (Cauchy-Schwarz), deci suma acestor margini pe partile ramase, plus produsele deja calculate, margineste
+// N * sum(I * T) - sum(I) * sum(T). Cand nici ea nu ajunge la valoarea care ar da corelatia ps, fereastra iese.
+// Testul se face intai fara niciun produs (ferestrele uniforme sunt excluse si ele dinainte), apoi dupa fiecare
+// bloc. Ferestrele se iau cate 16, cat calculeaza kernelul odata; ce ramane dupa ultimul bloc are produsul complet
+// si e evaluat cu NormalizedCorrelation. mean vine de la CascadeBuffer, o data pe banda. work[0] aduna produsele
+// pixel cu pixel calculate, work[1] pe cele ale cautarii complete
+void CascadeSlide(corrData image, templateSet s, double ps, windowList *found, cascadePlan const *c, segment g,
+                  double *mean, uint64_t *work) {
+    unsigned int parts = (*c).parts, count, x, k, b, p, rows, start, live;
+    double *spread = mean + 16 * parts, *bound = spread + 16 * parts;
+    double scale[16], share[16], need[16], n = s.area, pixels, a, d;
+    int64_t sum[16], variance[16], partSum, partSquare;
+    uint32_t product[16], part[16] = {0};
+    int t;
+
+    image.f.width = s.width;
+    image.f.height = s.height;
+    image.f.y = g.y + s.height / 2;
+    PROBE_COUNT(PROBE_WINDOWS, (uint64_t) (g.last - g.first) * s.count);
+    for(x = g.first; x < g.last; x += 16) {
+        // ferestrele de dupa count (la capatul segmentului) sunt tratate ca uniforme
+        count = min(16, g.last - x);
+        for(k = 0; k < 16; k ++) {
+            sum[k] = variance[k] = 0;
+            if(k < count) {
+                image.f.x = x + k + s.width / 2;
+                WindowStats(image, sum + k, variance + k);
+            }
+            scale[k] = ps * sqrt((double) variance[k]) / (n - 1);
+            share[k] = sum[k] / n;
+        }
+        // media si deviatia fiecarei parti din fiecare fereastra, o data pentru toate sabloanele
+        for(p = 0; p < parts; p ++) {
+            rows = min((p + 1) * CASCADE_ROWS, s.height) - p * CASCADE_ROWS;
+            pixels = (double) rows * s.width;
+            for(k = 0; k < count; k ++) {
+                RectSums(image.s, x + k, g.y + p * CASCADE_ROWS, s.width, rows, &partSum, &partSquare);
+                mean[p * 16 + k] = partSum / pixels;
+                spread[p * 16 + k] = sqrt(max(partSquare - (double) partSum * partSum / pixels, 0));
+            }
+        }
+
+        for(t = 0; t < s.count; t ++) {
+            work[1] += (uint64_t) count * s.area;
+            // bound[p * 16 + k] = marginea produselor de pe partile p..parts - 1
+            for(p = parts; p -- > 0; ) {
+                for(k = 0; k < 16; k ++) {
+                    bound[p * 16 + k] = bound[(p + 1) * 16 + k] + mean[p * 16 + k] * (*c).sum[t * parts + p] +
+                                        spread[p * 16 + k] * (*c).deviation[t * parts + p];
+                }
+            }
+            // need = cel mai mic produs cu care fereastra ar mai trece de ps, cu o marja pentru rotunjiri; o fereastra
+            // abandonata primeste need infinit
+            live = 0;
+            for(k = 0; k < 16; k ++) {
+                product[k] = 0;
+                a = scale[k] * (*c).root[t];
+                d = share[k] * s.sum[t];
+                need[k] = a + d - 1e-9 * (fabs(a) + fabs(d));
+                need[k] = variance[k] != 0 && bound[k] >= need[k] ? need[k] : HUGE_VAL;
+                live += need[k] != HUGE_VAL;
+            }
+            // sablonul uniform are scorul 0 pe orice fereastra, indiferent de produs
+            if(s.variance[t] == 0) {
+                live = 0;
+                for(k = 0; k < 16; k ++) {
+                    need[k] = variance[k] != 0 ? 0 : HUGE_VAL;
+                }
+            }
+
+            // kernelul ia toate cele 16 ferestre odata, si pe cele deja abandonate
+            for(b = 0, start = 0; b < (*c).blocks && live > 0; start = (*c).end[b ++]) {
+                (*c).kernel[b](image.v.pixel + (size_t) (g.y + start) * image.v.width + x, image.v.width,
+                               s.pixel + t * s.area + start * s.width, s.width, (*c).end[b] - start, count, part);
+                work[0] += (uint64_t) count * s.width * ((*c).end[b] - start);
+                p = ((*c).end[b] + CASCADE_ROWS - 1) / CASCADE_ROWS;
+                live = 0;
+                for(k = 0; k < 16; k ++) {
+                    product[k] += part[k];
+                    need[k] = product[k] + bound[p * 16 + k] >= need[k] ? need[k] : HUGE_VAL;
+                    live += need[k] != HUGE_VAL;
+                }
+            }
+
+            for(k = 0; k < count; k ++) {
+                if(need[k] == HUGE_VAL)
+                    continue;
+                image.f.x = x + k + s.width / 2;
+                a = NormalizedCorrelation(sum[k], variance[k], &s, t, product[k]);
+                if(a > ps)
+                    AddWindow(found + t, image.f, a, s.c[t]);
+            }
+        }
+    }
+}
+
+// toate ferestrele cu coltul de sus pe randurile first..last-1, rand cu rand; cu cascade != NULL prin CascadeSlide
+void ImageSlide(corrData image, templateSet s, double ps, windowList *found, productKernel kernel,
+                cascadePlan const *cascade, uint64_t *work, unsigned int first, unsigned int last) {
+    uint32_t *product;
+    double *bound;
+    segment g;
+    PROBE_START(start);
+
+    if(image.v.width < s.width || image.v.height < s.height)
+        return;
+    g.first = 0;
+    g.last = image.v.width - s.width + 1;
+    product = malloc(s.count * g.last * sizeof(uint32_t));
+    bound = CascadeBuffer(cascade);
+
+    for(g.y = first; g.y < last; g.y ++) {
+        if(cascade != NULL)
+            CascadeSlide(image, s, ps, found, cascade, g, bound, work);
+        else
+            SegmentSlide(image, s, ps, found, kernel, g, product);
+    }
+
+    free(product);
+    free(bound);
+    PROBE_STOP(PROBE_IMAGE_SLIDE, start);
+}
+
+fftKernels PrepareFFT(templateSet s) {
+    size_t n = 64, h, r, k;
+    complexNumber *line;
+    fftKernels f;
+    double *tile;
+    int t;
+
+    while(n < 4 * max(s.width, s.height))
+        n *= 2;
+    h = n / 2 + 1;
+    f.p = PlanFFT(n);
+    f.validX = n - s.width + 1;
+    f.validY = n - s.height + 1;
+    f.kernel = malloc(s.count * n * h * sizeof(complexNumber));
+    tile = calloc(n * n, sizeof(double));
+    line = malloc(n * sizeof(complexNumber));
+
+    for(t = 0; t < s.count; t ++) {
+        for(r = 0; r < s.height; r ++) {
+            for(k = 0; k < s.width; k ++) {
+                tile[r * n + k] = s.pixel[t * s.area + r * s.width + k];
+            }
+        }
+        RealForward(f.p, tile, f.kernel + t * n * h, line);
+    }
+
+    free(tile);
+    free(line);
+    return f;
+}
+
+void FreeKernels(fftKernels *f) {
+    FreePlan(&(*f).p);
+    free((*f).kernel);
+}
+
+// aceleasi ferestre, in aceeasi ordine, ca ImageSlide, dar sum(I * T) vine din corelatia circulara pe blocuri
+// n x n (overlap-save): fiecare bloc da produsele pentru (n - width + 1) x (n - height + 1) ferestre, iar
+// transformata blocului se face o data pentru toate sabloanele. Produsele sunt intregi si se rotunjesc; eroarea
+// FFT in double e cu multe ordine de marime sub 0.5 pentru sabloane de pana la 512 x 512, iar sumele ferestrei vin
+// exact din imaginile integrale, deci scorurile sunt aceleasi ca la CrossCorrelation (|diferenta| < 1e-9; TM_FFT_CHECK
+// o verifica). first trebuie sa fie multiplu de validY
+void ImageSlideFFT(corrData image, templateSet s, double ps, windowList *found, fftKernels const *f,
+                   unsigned int first, unsigned int last) {
+    size_t n = (*f).p.n, h = n / 2 + 1, validX = (*f).validX, validY = (*f).validY, columns, ox, oy, r, k, band, i;
+    complexNumber *spec, *work, *line, a, b;
+    int64_t *product, sum, variance;
+    double *tile, corr;
+    int t;
+    PROBE_START(start);
+
+    if(image.v.width < s.width || image.v.height < s.height)
+        return;
+    columns = image.v.width - s.width + 1;
+    image.f.width = s.width;
+    image.f.height = s.height;
+
+    tile = malloc(n * n * sizeof(double));
+    spec = malloc(n * h * sizeof(complexNumber));
+    work = malloc(n * h * sizeof(complexNumber));
+    line = malloc(n * sizeof(complexNumber));
+    product = malloc(s.count * validY * columns * sizeof(int64_t));
+
+    for(oy = first; oy < last; oy += validY) {
+        band = min(validY, last - oy);
+        for(ox = 0; ox < columns; ox += validX) {
+            for(r = 0; r < n; r ++) {
+                for(k = 0; k < n; k ++) {
+                    tile[r * n + k] = oy + r < image.v.height && ox + k < image.v.width ?
+                                      image.v.pixel[(oy + r) * image.v.width + ox + k] : 0;
+                }
+            }
+            RealForward((*f).p, tile, spec, line);
+
+            // corelatie: spectrul blocului inmultit cu conjugatul spectrului sablonului
+            for(t = 0; t < s.count; t ++) {
+                for(i = 0; i < n * h; i ++) {
+                    a = spec[i];
+                    b = (*f).kernel[t * n * h + i];
+                    work[i].re = a.re * b.re + a.im * b.im;
+                    work[i].im = a.im * b.re - a.re * b.im;
+                }
+                RealInverse((*f).p, work, tile, line);
+
+                for(r = 0; r < band; r ++) {
+                    for(k = 0; k < validX && ox + k < columns; k ++) {
+                        product[(t * validY + r) * columns + ox + k] = llround(tile[r * n + k]);
+                    }
+                }
+            }
+        }
+
+        PROBE_COUNT(PROBE_WINDOWS, (uint64_t) band * columns * s.count);
+        for(r = 0; r < band; r ++) {
+            image.f.y = oy + r + s.height / 2;
+            for(k = 0; k < columns; k ++) {
+                image.f.x = k + s.width / 2;
+                WindowStats(image, &sum, &variance);
+                if(variance == 0)
+                    continue;
+
+                for(t = 0; t < s.count; t ++) {
+                    corr = NormalizedCorrelation(sum, variance, &s, t, product[(t * validY + r) * columns + k]);
+                    if(corr > ps)
+                        AddWindow(found + t, image.f, corr, s.c[t]);
+                }
+            }
+        }
+    }
+
+    free(tile);
+    free(spec);
+    free(work);
+    free(line);
+    free(product);
+    PROBE_STOP(PROBE_IMAGE_SLIDE_FFT, start);
+}
+
+void SlideTask(void *arg, int k) {
+    slideJob *job = arg;
+    unsigned int first = k * (*job).band, last = min(first + (*job).band, (*job).rows);
+
+    if((*job).fft != NULL)
+        ImageSlideFFT((*job).image, (*job).s, (*job).ps, (*job).found + k * (*job).s.count, (*job).fft, first, last);
+    else
+        ImageSlide((*job).image, (*job).s, (*job).ps, (*job).found + k * (*job).s.count, (*job).kernel,
+                   (*job).cascade, (*job).work + 2 * k, first, last);
+}
+
+// fiecare pixel e media, rotunjita, unui bloc 2 x 2; ultima coloana (sau rand) impara se pierde
+grayImage HalfImage(grayImage v) {
+    grayImage h = {v.height / 2, v.width / 2, malloc(max((size_t) (v.width / 2) * (v.height / 2), 1))};
+    unsigned char const *a, *b;
+    unsigned int i, j;
+
+    for(i = 0; i < h.height; i ++) {
+        a = v.pixel + (size_t) 2 * i * v.width;
+        b = a + v.width;
+        for(j = 0; j < h.width; j ++) {
+            h.pixel[(size_t) i * h.width + j] = (a[2 * j] + a[2 * j + 1] + b[2 * j] + b[2 * j + 1] + 2) / 4;
+        }
+    }
+
+    return h;
+}
+
+// suma ferestrei cu coltul in (x, y) si N * suma patratelor - suma^2, cu N = width * height al nivelului
+void LevelStats(pyramidLevel const *l, unsigned int x, unsigned int y, int64_t *sum, int64_t *variance) {
+    int64_t n = (int64_t) (*l).width * (*l).height, square;
+
+    RectSums((*l).s, x, y, (*l).width, (*l).height, sum, &square);
+    (*variance) = n * square - (*sum) * (*sum);
+}
+
+// aceeasi formula ca NormalizedCorrelation, pe un nivel al piramidei; ferestrele fara contrast au scorul 0
+double LevelCorrelation(pyramidLevel const *l, int t, int64_t sum, int64_t variance, int64_t product) {
+    int64_t n = (int64_t) (*l).width * (*l).height, cross;
+
+    if(variance == 0 || (*l).variance[t] == 0 || variance < PYRAMID_CONTRAST * PYRAMID_CONTRAST * (*l).variance[t])
+        return 0;
+
+    cross = n * product - sum * (*l).sum[t];
+    return (n - 1) * (double) cross / (n * sqrt((double) variance * (*l).variance[t]));
+}
+
+void AddCandidate(candidateList *l, size_t poz) {
+    if((*l).ct == (*l).cap) {
+        (*l).cap = 2 * (*l).cap + 16;
+        (*l).poz = realloc((*l).poz, (*l).cap * sizeof(size_t));
+        PROBE_COUNT(PROBE_REALLOC, 1);
+    }
+    (*l).poz[(*l).ct ++] = poz;
+}
+
+// nivelul l + 1 din nivelul l: board-ul, sumele lui si sabloanele, micsorate de doua ori
+pyramidLevel HalfLevel(pyramidLevel const *l, int count) {
+    pyramidLevel h;
+    grayImage g, t;
+    int64_t n, sum, square;
+    int k;
+    size_t i;
+
+    h.v = HalfImage((*l).v);
+    h.s = IntegralImage(h.v);
+    h.width = (*l).width / 2;
+    h.height = (*l).height / 2;
+    n = (int64_t) h.width * h.height;
+    h.pixel = malloc(count * n);
+    h.sum = malloc(count * sizeof(int64_t));
+    h.variance = malloc(count * sizeof(int64_t));
+
+    for(k = 0; k < count; k ++) {
+        g.height = (*l).height;
+        g.width = (*l).width;
+        g.pixel = (*l).pixel + k * g.height * g.width;
+        t = HalfImage(g);
+        memcpy(h.pixel + k * n, t.pixel, n);
+        free(t.pixel);
+
+        sum = square = 0;
+        for(i = 0; i < (size_t) n; i ++) {
+            sum += h.pixel[k * n + i];
+            square += h.pixel[k * n + i] * h.pixel[k * n + i];
+        }
+        h.sum[k] = sum;
+        h.variance[k] = n * square - sum * sum;
+    }
+
+    return h;
+}
+
+void FreeLevel(pyramidLevel *l) {
+    free((*l).v.pixel);
+    FreeIntegral(&(*l).s);
+    free((*l).pixel);
+    free((*l).sum);
+    free((*l).variance);
+}
 
-    for(image.f.y = template.f.y; image.f.y < image.v.height - template.f.y; image.f.y ++) {
-        for(image.f.x = template.f.x; image.f.x < image.v.width - template.f.x; image.f.x ++) {
-            corr = CrossCorrelation(image, template);
+// pe nivelul cel mai mic se evalueaza toate ferestrele; statisticile ferestrei sunt comune sabloanelor
+void CoarseTask(void *arg, int k) {
+    pyramidJob *job = arg;
+    pyramidLevel const *l = (*job).level + (*job).levels - 1;
+    unsigned int first = k * (*job).band, last = min(first + (*job).band, (*job).rows), columns, x, y;
+    int64_t sum, variance;
+    uint32_t *product;
+    int t;
+
+    columns = (*l).v.width - (*l).width + 1;
+    product = malloc((*job).count * columns * sizeof(uint32_t));
+    for(y = first; y < last; y ++) {
+        for(t = 0; t < (*job).count; t ++) {
+            (*job).coarse((*l).v.pixel + (size_t) y * (*l).v.width, (*l).v.width,
+                          (*l).pixel + (size_t) t * (*l).width * (*l).height, (*l).width, (*l).height, columns,
+                          product + t * columns);
+        }
+
+        for(x = 0; x < columns; x ++) {
+            LevelStats(l, x, y, &sum, &variance);
+            if(variance == 0)
+                continue;
 
-            if(corr > ps) {
-                (*D) = realloc ((*D), ((*ct) + 1) * sizeof (window));
-                (*D)[(*ct)] = image.f;
-                (*D)[(*ct)].corr = corr;
-                (*D)[(*ct)].c = template.f.c;
-                (*ct) ++;
+            for(t = 0; t < (*job).count; t ++) {
+                if(LevelCorrelation(l, t, sum, variance, product[t * columns + x]) > PYRAMID_PS)
+                    AddCandidate((*job).found + k * (*job).count + t, (size_t) y * columns + x);
             }
         }
     }
+    free(product);
+}
+
+// fiecare fereastra de pe nivelul l + 1 acopera, pe nivelul l, ferestrele cu coltul in [2x - 1, 2x + 2] x [2y - 1, 2y + 2];
+// ele se marcheaza in mark, un bit pe fereastra, cu words cuvinte pe rand, deci se citesc apoi in ordinea randurilor
+void ExpandCandidates(candidateList c, unsigned int fine, unsigned int columns, unsigned int rows, uint64_t *mark) {
+    unsigned int x, y, x0, y0, words = (columns + 63) / 64;
+    size_t i;
+
+    for(i = 0; i < c.ct; i ++) {
+        x0 = c.poz[i] % fine * 2;
+        y0 = c.poz[i] / fine * 2;
+        for(y = y0 > 0 ? y0 - 1 : 0; y <= y0 + 2 && y < rows; y ++)
+            for(x = x0 > 0 ? x0 - 1 : 0; x <= x0 + 2 && x < columns; x ++)
+                mark[(size_t) y * words + x / 64] |= (uint64_t) 1 << (x % 64);
+    }
+}
+
+// candidatii sablonului t coboara pana la nivelul 1, pastrand doar ce trece de PYRAMID_PS pe fiecare nivel
+void RefineTask(void *arg, int t) {
+    pyramidJob *job = arg;
+    candidateList c = (*job).found[t], next;
+    unsigned int columns, rows, words, x, y, w;
+    int64_t sum, variance;
+    pyramidLevel const *l;
+    uint64_t *mark, bits;
+    uint32_t product;
+    int level;
+
+    for(level = (*job).levels - 2; level >= 1; level --) {
+        l = (*job).level + level;
+        columns = (*l).v.width - (*l).width + 1;
+        rows = (*l).v.height - (*l).height + 1;
+        words = (columns + 63) / 64;
+        mark = calloc((size_t) rows * words, sizeof(uint64_t));
+        ExpandCandidates(c, (*job).level[level + 1].v.width - (*job).level[level + 1].width + 1, columns, rows, mark);
+        free(c.poz);
+
+        next.poz = NULL;
+        next.ct = next.cap = 0;
+        for(y = 0; y < rows; y ++) {
+            for(w = 0; w < words; w ++) {
+                for(bits = mark[(size_t) y * words + w]; bits != 0; bits &= bits - 1) {
+                    x = w * 64 + __builtin_ctzll(bits);
+                    LevelStats(l, x, y, &sum, &variance);
+                    ProductsScalar((*l).v.pixel + (size_t) y * (*l).v.width + x, (*l).v.width,
+                                   (*l).pixel + (size_t) t * (*l).width * (*l).height, (*l).width, (*l).height, 1,
+                                   &product);
+                    if(LevelCorrelation(l, t, sum, variance, product) > PYRAMID_PS)
+                        AddCandidate(&next, (size_t) y * columns + x);
+                }
+            }
+        }
+        free(mark);
+        c = next;
+    }
+    (*job).found[t] = c;
+}
+
+void SegmentTask(void *arg, int k) {
+    pyramidJob *job = arg;
+    size_t first = k * (size_t) (*job).band, last = min(first + (*job).band, (*job).segmentCount), i;
+    uint32_t *product = malloc((*job).s.count * ((*job).image.v.width - (*job).s.width + 1) * sizeof(uint32_t));
+    double *bound = CascadeBuffer((*job).cascade);
+
+    for(i = first; i < last; i ++) {
+        if((*job).cascade != NULL)
+            CascadeSlide((*job).image, (*job).s, (*job).ps, (*job).windows + k * (*job).s.count, (*job).cascade,
+                         (*job).segments[i], bound, (*job).work + 2 * k);
+        else
+            SegmentSlide((*job).image, (*job).s, (*job).ps, (*job).windows + k * (*job).s.count, (*job).kernel,
+                         (*job).segments[i], product);
+    }
+    free(product);
+    free(bound);
 }
 
-void TemplateMatching(char *imagePath, char *templatePath, double ps, unsigned int *ct, window **D, pixelRGB c) {
-    Grayscale(imagePath);
-    Grayscale(templatePath);
+// cate niveluri din cele cerute se pot folosi: sabloanele raman de macar 3 x 3 pixeli si incap in board; pe nivelul
+// 0 produsele se calculeaza direct, deci sabloanele trebuie sa aiba cel mult DIRECT_MAX_AREA pixeli
+int PyramidDepth(grayImage board, templateSet s, int levels) {
+    unsigned int w = s.width, h = s.height, width = board.width, height = board.height;
+    int l;
+
+    if(width < w || height < h || s.area > DIRECT_MAX_AREA)
+        return 1;
+    for(l = 1; l < levels && w / 2 >= 3 && h / 2 >= 3 && width / 2 >= w / 2 && height / 2 >= h / 2; l ++) {
+        w /= 2;
+        h /= 2;
+        width /= 2;
+        height /= 2;
+    }
+    return l;
+}
+
+// cautare grosiera pe o piramida de levels > 1 niveluri (dat de PyramidDepth). Pe nivelul 0, candidatii tuturor
+// sabloanelor se unesc in segmente de rand (doi candidati la mai putin de 16 coloane sunt in acelasi segment) si
+// fiecare segment e evaluat ca la cautarea completa, cu toate sabloanele si scorul exact. Intoarce listele
+// benzilor, ca SlideTask, deci ordinea e cea a cautarii complete; se pot pierde ferestre care pe nivelurile mici
+// nu trec de PYRAMID_PS. Cu cascade != NULL segmentele trec prin CascadeSlide, iar work primeste totalul lor
+windowList *PyramidSlide(grayImage board, integralImage sums, templateSet s, double ps, int levels,
+                         productKernel kernel, cascadePlan const *cascade, uint64_t *work, unsigned int *bands) {
+    pyramidLevel *level = malloc(levels * sizeof(pyramidLevel));
+    unsigned int tasks = 4 * PoolThreads(), columns, rows, words, k, w, x, y;
+    uint64_t *mark, bits;
+    candidateList *c;
+    size_t i, cap = 0;
+    char const *name;
+    pyramidJob job;
+    int l, t;
+
+    level[0].v = board;
+    level[0].s = sums;
+    level[0].width = s.width;
+    level[0].height = s.height;
+    level[0].pixel = s.pixel;
+    level[0].sum = s.sum;
+    level[0].variance = s.variance;
+    for(l = 1; l < levels; l ++) {
+        level[l] = HalfLevel(level + l - 1, s.count);
+    }
+
+    job.level = level;
+    job.levels = levels;
+    job.count = s.count;
+    job.coarse = SelectKernel(level[levels - 1].width, level[levels - 1].height, &name);
+    job.rows = level[levels - 1].v.height - level[levels - 1].height + 1;
+    job.band = (job.rows + tasks - 1) / tasks;
+    (*bands) = (job.rows + job.band - 1) / job.band;
+    job.found = calloc((*bands) * s.count, sizeof(candidateList));
+    ParallelFor((*bands), CoarseTask, &job);
+
+    // candidatii benzilor se lipesc pe sabloane, apoi fiecare sablon e rafinat separat
+    for(t = 0; t < s.count; t ++) {
+        for(k = 1; k < (*bands); k ++) {
+            c = job.found + k * s.count + t;
+            for(i = 0; i < (*c).ct; i ++) {
+                AddCandidate(job.found + t, (*c).poz[i]);
+            }
+            free((*c).poz);
+        }
+    }
+    ParallelFor(s.count, RefineTask, &job);
+
+    columns = board.width - s.width + 1;
+    rows = board.height - s.height + 1;
+    words = (columns + 63) / 64;
+    mark = calloc((size_t) rows * words, sizeof(uint64_t));
+    for(t = 0; t < s.count; t ++) {
+        ExpandCandidates(job.found[t], level[1].v.width - level[1].width + 1, columns, rows, mark);
+        free(job.found[t].poz);
+    }
+    free(job.found);
+
+    // segmentele se rotunjesc la 16 ferestre, cat ia kernelul odata; ferestrele in plus au tot scorul exact
+    job.segments = NULL;
+    job.segmentCount = 0;
+    for(y = 0; y < rows; y ++) {
+        for(w = 0; w < words; w ++) {
+            for(bits = mark[(size_t) y * words + w]; bits != 0; bits &= bits - 1) {
+                x = w * 64 + __builtin_ctzll(bits);
+                if(job.segmentCount > 0 && job.segments[job.segmentCount - 1].y == y &&
+                   x < job.segments[job.segmentCount - 1].last + 16) {
+                    job.segments[job.segmentCount - 1].last = x + 1;
+                    continue;
+                }
+                if(job.segmentCount == cap) {
+                    cap = 2 * cap + 16;
+                    job.segments = realloc(job.segments, cap * sizeof(segment));
+                    PROBE_COUNT(PROBE_REALLOC, 1);
+                }
+                job.segments[job.segmentCount].y = y;
+                job.segments[job.segmentCount].first = x;
+                job.segments[job.segmentCount].last = x + 1;
+                job.segmentCount ++;
+            }
+        }
+    }
+    free(mark);
+    for(i = 0; i < job.segmentCount; i ++) {
+        x = job.segments[i].first;
+        job.segments[i].last = min(x + (job.segments[i].last - x + 15) / 16 * 16, columns);
+        if(i + 1 < job.segmentCount && job.segments[i + 1].y == job.segments[i].y)
+            job.segments[i].last = min(job.segments[i].last, job.segments[i + 1].first);
+    }
+
+    job.image.v = board;
+    job.image.s = sums;
+    job.s = s;
+    job.ps = ps;
+    job.kernel = kernel;
+    job.cascade = cascade;
+    job.band = (job.segmentCount + tasks - 1) / tasks;
+    (*bands) = job.band > 0 ? (job.segmentCount + job.band - 1) / job.band : 0;
+    job.windows = calloc(max((*bands), 1) * s.count, sizeof(windowList));
+    job.work = calloc(2 * max((*bands), 1), sizeof(uint64_t));
+    ParallelFor((*bands), SegmentTask, &job);
+    for(k = 0; k < 2 * (*bands); k ++) {
+        work[k % 2] += job.work[k];
+    }
+    free(job.work);
 
-    corrData image, template;
-    image.v = LoadImage(imagePath);
-    template.v = LoadImage(templatePath);
+    free(job.segments);
+    for(l = 1; l < levels; l ++) {
+        FreeLevel(level + l);
+    }
+    free(level);
+    return job.windows;
+}
 
-    template.f.x = x_size / 2;
-    template.f.y = y_size / 2;
-    template.f.c = c;
+// board si sumele lui sunt calculate o singura data; detectiile raman grupate pe sabloane, in ordinea lor,
+// la fel ca atunci cand fiecare sablon era cautat separat. Benzile se impart pe fire, dar listele lor se lipesc
+// in ordinea randurilor, deci rezultatul nu depinde de numarul de fire. Cu levels > 1 cautarea se face pe piramida.
+// Cu cascade != 0 produsele directe se calculeaza prin CascadeSlide (si pentru sabloanele mari, in locul FFT), iar
+// work[0] si work[1] primesc produsele pixel cu pixel calculate si pe cele ale cautarii complete.
+// Intoarce numele metodei folosite
+char const *TemplateMatching(grayImage board, integralImage sums, templateSet s, double ps, int levels,
+                             int cascade, uint64_t *work, unsigned int *ct, window **D) {
+    unsigned int total = (*ct), unit = 1, bands = 0, tasks = 4 * PoolThreads(), k;
+    char const *engine = "fft";
+    fftKernels fft = {{0}};
+    cascadePlan plan;
+    windowList *l;
+    slideJob job;
+    int t;
+    PROBE_START(start);
+
+    job.image.v = board;
+    job.image.s = sums;
+    job.s = s;
+    job.ps = ps;
+    job.rows = board.width >= s.width && board.height >= s.height ? board.height - s.height + 1 : 0;
+    job.fft = NULL;
+    job.cascade = NULL;
+    if(cascade && s.area <= DIRECT_MAX_AREA) {
+        plan = PrepareCascade(s);
+        job.cascade = &plan;
+    }
+    levels = PyramidDepth(board, s, levels);
+    if(levels > 1) {
+        job.found = PyramidSlide(board, sums, s, ps, levels, SelectKernel(s.width, s.height, &engine), job.cascade,
+                                 work, &bands);
+        engine = "pyramid";
+    } else {
+        if(job.cascade != NULL) {
+            engine = "cascade";
+        } else if(s.area >= FFT_MIN_AREA || s.area > DIRECT_MAX_AREA) {
+            // peste DIRECT_MAX_AREA produsele kernelilor directi nu incap in 32 de biti; FFT-ul le calculeaza in
+            // double, iar sumele ferestrei vin din square, pe 64 de biti
+            fft = PrepareFFT(s);
+            job.fft = &fft;
+            unit = fft.validY;
+        } else {
+            job.kernel = SelectKernel(s.width, s.height, &engine);
+        }
 
-    ImageSlide(image, template, ps, &(*ct), &(*D));
+        // benzile au un numar intreg de blocuri FFT, ca impartirea pe blocuri sa fie aceeasi ca la o singura banda
+        job.band = ((job.rows + unit - 1) / unit + tasks - 1) / tasks * unit;
+        if(job.rows > 0)
+            bands = (job.rows + job.band - 1) / job.band;
+        job.found = calloc(max(bands, 1) * s.count, sizeof(windowList));
+        job.work = calloc(2 * max(bands, 1), sizeof(uint64_t));
+        ParallelFor(bands, SlideTask, &job);
+        for(k = 0; k < 2 * bands; k ++) {
+            work[k % 2] += job.work[k];
+        }
+        free(job.work);
+    }
 
-    free(image.v.pixel);
-    free(template.v.pixel);
+    for(k = 0; k < bands * s.count; k ++) {
+        total += job.found[k].ct;
+    }
+    (*D) = realloc((*D), max(total, 1) * sizeof(window));
+    PROBE_COUNT(PROBE_REALLOC, 1);
+    for(t = 0; t < s.count; t ++) {
+        for(k = 0; k < bands; k ++) {
+            l = job.found + k * s.count + t;
+            if((*l).ct > 0)
+                memcpy((*D) + (*ct), (*l).f, (*l).ct * sizeof(window));
+            (*ct) += (*l).ct;
+            free((*l).f);
+        }
+    }
+    free(job.found);
+    if(job.fft != NULL)
+        FreeKernels(&fft);
+    if(job.cascade != NULL)
+        FreeCascade(&plan);
+    PROBE_STOP(PROBE_TEMPLATE_MATCHING, start);
+    return engine;
 }
 
 void UpperRightCorner(window f, int *x, int *y) {
-    (*x) = f.x + x_size / 2;
-    (*y) = f.y + y_size / 2;
+    (*x) = f.x - f.width / 2 + f.width - 1;
+    (*y) = f.y - f.height / 2 + f.height - 1;
 }
 
 void BottomLeftCorner(window f, int *x, int *y) {
-    (*x) = f.x - x_size / 2;
-    (*y) = f.y - y_size / 2;
+    (*x) = f.x - f.width / 2;
+    (*y) = f.y - f.height / 2;
 }
 
 void IntersectionUpperRightCorner(window f1, window f2, int *x, int *y) {
@@ -311,15 +1526,15 @@ void IntersectionBottomLeftCorner(window f1, window f2, int *x, int *y) {
     (*y) = max(y1, y2);
 }
 
+// ferestrele care nu se ating au intersectia 0, pe orice directie ar fi departate
 double IntersectionArea(window *f, int x, int y) {
-    if(abs((int)(f[x].x - f[y].x)) > x_size || abs((int)(f[x].y - f[y].y) > y_size))
-        return 0;
-
     int x1, x2;
     int y1, y2;
 
     IntersectionBottomLeftCorner(f[x], f[y], &x1, &y1);
     IntersectionUpperRightCorner(f[x], f[y], &x2, &y2);
+    if(x2 < x1 || y2 < y1)
+        return 0;
 
     double xy_area = (x2 - x1 + 1) * (y2 - y1 + 1);
     return xy_area;
@@ -328,106 +1543,512 @@ double IntersectionArea(window *f, int x, int y) {
 double SpatialOverlap(window *f, int x, int y) {
     double x_area, y_area, xy_area, overlap;
 
-    x_area = y_area = x_size * y_size;
+    x_area = (double) f[x].width * f[x].height;
+    y_area = (double) f[y].width * f[y].height;
     xy_area = IntersectionArea(f, x, y);
     overlap = xy_area / (x_area + y_area - xy_area);
 
     return overlap;
 }
 
-void ItemsRemoval(window **f, _Bool const a[], unsigned int *n) {
-    unsigned int i, ct = 0;
-    for(i = 0; i < (*n); i ++)
-        if(a[i] == 1)
-            ct ++;
+// greedy, in ordinea descrescatoare a corelatiei: o detectie ramane daca nu se suprapune peste niciuna pastrata
+// inaintea ei. Doua ferestre care se suprapun sunt la mai putin de width pe orizontala si height pe verticala (cele
+// mai mari dimensiuni ale detectiilor), deci ajunge comparatia cu cele pastrate in celulele vecine dintr-o grila de
+// width x height. Cele pastrate se muta la inceputul lui f, in aceeasi ordine
+void NonMaxRemoval(window **f, unsigned int *n) {
+    unsigned int i, k, ct = 0, columns = 1, rows = 1, width = 1, height = 1, cx, cy, x, y;
+    double ps = 0.2;
+    int *head, *next, j;
+    _Bool keep;
+    PROBE_START(start);
+
+    for(i = 0; i < (*n); i ++) {
+        width = max(width, (*f)[i].width);
+        height = max(height, (*f)[i].height);
+    }
+    for(i = 0; i < (*n); i ++) {
+        columns = max(columns, (*f)[i].x / width + 1);
+        rows = max(rows, (*f)[i].y / height + 1);
+    }
+    head = malloc((size_t) columns * rows * sizeof(int));
+    next = malloc(max((*n), 1) * sizeof(int));
+    for(k = 0; k < columns * rows; k ++)
+        head[k] = -1;
 
-    window *d = malloc(ct * sizeof(window));
-    ct = 0;
     for(i = 0; i < (*n); i ++) {
-        if (a[i] == 1) {
-            d[ct] = (*f)[i];
+        cx = (*f)[i].x / width;
+        cy = (*f)[i].y / height;
+        keep = 1;
+        for(y = cy > 0 ? cy - 1 : 0; keep && y <= min(cy + 1, rows - 1); y ++)
+            for(x = cx > 0 ? cx - 1 : 0; keep && x <= min(cx + 1, columns - 1); x ++)
+                for(j = head[y * columns + x]; keep && j >= 0; j = next[j]) {
+                    PROBE_COUNT(PROBE_NMS_COMPARISONS, 1);
+                    if(SpatialOverlap((*f), j, i) > ps)
+                        keep = 0;
+                }
+
+        if(keep) {
+            (*f)[ct] = (*f)[i];
+            next[ct] = head[cy * columns + cx];
+            head[cy * columns + cx] = ct;
             ct ++;
         }
     }
 
-    //free(f);
+    free(head);
+    free(next);
     (*n) = ct;
-    (*f) = d;
+    PROBE_STOP(PROBE_NON_MAX_REMOVAL, start);
 }
 
-void NonMaxRemoval(window **f, unsigned int *n) {
-    int i, j;
-    _Bool a[(*n)];
-    double ps = 0.2;
+int CmpPlace(const void *a, const void *b) {
+    window const *f = a, *g = b;
+
+    if((*f).y != (*g).y)
+        return (*f).y < (*g).y ? -1 : 1;
+    if((*f).x != (*g).x)
+        return (*f).x < (*g).x ? -1 : 1;
+    if((*f).c.red != (*g).c.red)
+        return (*f).c.red < (*g).c.red ? -1 : 1;
+    if((*f).c.green != (*g).c.green)
+        return (*f).c.green < (*g).c.green ? -1 : 1;
+    if((*f).c.blue != (*g).c.blue)
+        return (*f).c.blue < (*g).c.blue ? -1 : 1;
+    return 0;
+}
 
-    // initializez vectorul de aparitii
-    for(i = 0; i < (*n); i ++)
-        a[i] = 1;
+// repeta cautarea completa si numara cate din detectiile ei, dupa NMS, le gaseste si piramida (aceeasi fereastra,
+// acelasi sablon); f ramane neschimbat
+void PyramidCheck(grayImage board, integralImage sums, templateSet s, double ps, window const *f, unsigned int ct,
+                  double seconds) {
+    unsigned int full = 0, found = ct, i = 0, j = 0, both = 0, raw;
+    window *e = malloc(sizeof(window)), *p = malloc(max(ct, 1) * sizeof(window));
+    uint64_t work[2] = {0, 0};
+    double start, exhaustive;
+
+    start = Now();
+    TemplateMatching(board, sums, s, ps, 1, 0, work, &full, &e);
+    exhaustive = Now() - start;
+    raw = full;
+
+    memcpy(p, f, ct * sizeof(window));
+    qsort(e, full, sizeof(window), cmp);
+    qsort(p, found, sizeof(window), cmp);
+    NonMaxRemoval(&e, &full);
+    NonMaxRemoval(&p, &found);
+    qsort(e, full, sizeof(window), CmpPlace);
+    qsort(p, found, sizeof(window), CmpPlace);
+    while(i < full && j < found) {
+        if(CmpPlace(e + i, p + j) == 0) {
+            both ++;
+            i ++;
+            j ++;
+        } else if(CmpPlace(e + i, p + j) < 0) {
+            i ++;
+        } else {
+            j ++;
+        }
+    }
 
-    for(i = 0; i < (*n); i ++)
-        if (a[i] == 1)  // daca nu a fost deja eliminat elementul de pe aceasta pozitie
-            for (j = i + 1; j < (*n); j ++)
-                if (a[j] == 1 && SpatialOverlap((*f), i, j) > ps)
-                    a[j] = 0;   // marchez detectiile care trebuie eliminate
+    printf("Piramida: %u din %u detectii (recall %.2lf%%), %u din %u ferestre peste prag; de %.2lf ori mai rapid "
+           "(%.3lf s fata de %.3lf s)\n", both, full, full > 0 ? 100.0 * both / full : 100.0, ct, raw,
+           exhaustive / max(seconds, 1e-9), seconds, exhaustive);
+    free(e);
+    free(p);
+}
 
-    ItemsRemoval(&(*f), a, &(*n));
+// recalculeaza fiecare fereastra direct, cu CrossCorrelation, si numara cate din detectiile directe le-a gasit si
+// FFT-ul (aceeasi fereastra, acelasi sablon), cu diferenta maxima dintre scoruri; f ramane neschimbat
+void FFTCheck(grayImage board, integralImage sums, templateSet s, double ps, window const *f, unsigned int ct) {
+    unsigned int x, y, i = 0, j = 0, both = 0;
+    window *p = malloc(max(ct, 1) * sizeof(window));
+    windowList e = {NULL, 0, 0};
+    double corr, worst = 0;
+    corrData image;
+    int t;
+
+    image.v = board;
+    image.s = sums;
+    image.f.width = s.width;
+    image.f.height = s.height;
+    for(y = 0; y + s.height <= board.height; y ++) {
+        image.f.y = y + s.height / 2;
+        for(x = 0; x + s.width <= board.width; x ++) {
+            image.f.x = x + s.width / 2;
+            for(t = 0; t < s.count; t ++) {
+                corr = CrossCorrelation(image, s, t);
+                if(corr > ps)
+                    AddWindow(&e, image.f, corr, s.c[t]);
+            }
+        }
+    }
+
+    memcpy(p, f, ct * sizeof(window));
+    qsort(e.f, e.ct, sizeof(window), CmpPlace);
+    qsort(p, ct, sizeof(window), CmpPlace);
+    while(i < e.ct && j < ct) {
+        if(CmpPlace(e.f + i, p + j) == 0) {
+            worst = max(worst, fabs(e.f[i].corr - p[j].corr));
+            both ++;
+            i ++;
+            j ++;
+        } else if(CmpPlace(e.f + i, p + j) < 0) {
+            i ++;
+        } else {
+            j ++;
+        }
+    }
+
+    printf("FFT: %u din %u detectii directe, %u ferestre peste prag prin FFT; diferenta maxima intre scoruri %.3le\n",
+           both, e.ct, ct, worst);
+    free(e.f);
+    free(p);
 }
 
-void InitialiseAux(char *imagePath, char *auxiliaryImagePath) {
-    imageData v = LoadImage(imagePath);
-    SaveImage(v, auxiliaryImagePath);
-    free(v.pixel);
+// TM_PYRAMID=N si TM_CASCADE=1 aleg metoda de cautare, la fel in TaskIV si in --bench
+void MatchOptions(int *levels, int *cascade) {
+    char const *pyramid = getenv("TM_PYRAMID"), *c = getenv("TM_CASCADE");
+
+    (*levels) = pyramid != NULL ? atoi(pyramid) : 1;
+    (*cascade) = c != NULL && atoi(c) != 0;
 }
 
-void TaskIV(char *imagePath, window **f, unsigned int *ct) {
-    char templatePath[101], *auxiliaryImagePath = "auxiliary_image.bmp";
-    double ps = 0.5;
-    int i;
+// imaginea se citeste si se converteste o singura data; v ramane color, pentru ramele din TaskV. Fiecare set de
+// sabloane de aceeasi dimensiune e o cautare separata, iar detectiile lor se adauga in f in ordinea seturilor
+void TaskIV(char *imagePath, imageData *v, window **f, unsigned int *ct) {
+    char **templatePath = digitPath;
+    int levels, cascade;
+    uint64_t work[2];
+    double ps = MATCH_PS;
+    int i, sets;
     pixelRGB c[10];
+    grayImage board;
+    integralImage sums;
+    templateSet *templates, s;
+    double start, seconds, windows;
+    char const *engine;
+    unsigned int first;
 
     printf("Numele fisierului care contine imaginea color: ");
     fgets(imagePath, 101, stdin);   imagePath[strlen(imagePath) - 1] = '\0';
 
+    MatchOptions(&levels, &cascade);
     InitialiseColors(c);
-    InitialiseAux(imagePath, auxiliaryImagePath);
+    (*v) = LoadImage(imagePath);
+    board = Grayscale(*v);
+    sums = IntegralImage(board);
 
 //    printf("Numele fisierelor care contin sabloanele :\n");
 //    for(i = 0; i < 10; i ++) {
 //        printf("Cifra %d: ", i);
-//        fgets(templatePath, 101, stdin);    templatePath[strlen(templatePath) - 1] = '\0';
-//        TemplateMatching(auxiliaryImagePath, templatePath, ps, &(*ct), &(*f), c[i]);
+//        fgets(templatePath[i], 101, stdin);    templatePath[i][strlen(templatePath[i]) - 1] = '\0';
 //    }
 
-    TemplateMatching(auxiliaryImagePath, "cifra0.bmp", ps, &(*ct), &(*f), c[0]);
-    TemplateMatching(auxiliaryImagePath, "cifra1.bmp", ps, &(*ct), &(*f), c[1]);
-    TemplateMatching(auxiliaryImagePath, "cifra2.bmp", ps, &(*ct), &(*f), c[2]);
-    TemplateMatching(auxiliaryImagePath, "cifra3.bmp", ps, &(*ct), &(*f), c[3]);
-    TemplateMatching(auxiliaryImagePath, "cifra4.bmp", ps, &(*ct), &(*f), c[4]);
-    TemplateMatching(auxiliaryImagePath, "cifra5.bmp", ps, &(*ct), &(*f), c[5]);
-    TemplateMatching(auxiliaryImagePath, "cifra6.bmp", ps, &(*ct), &(*f), c[6]);
-    TemplateMatching(auxiliaryImagePath, "cifra7.bmp", ps, &(*ct), &(*f), c[7]);
-    TemplateMatching(auxiliaryImagePath, "cifra8.bmp", ps, &(*ct), &(*f), c[8]);
-    TemplateMatching(auxiliaryImagePath, "cifra9.bmp", ps, &(*ct), &(*f), c[9]);
+    sets = LoadTemplates(&templates, templatePath, c, 10);
+    for(i = 0; i < sets; i ++) {
+        s = templates[i];
+        first = (*ct);
+        work[0] = work[1] = 0;
+        start = Now();
+        engine = TemplateMatching(board, sums, s, ps, levels, cascade, work, &(*ct), &(*f));
+        seconds = Now() - start;
+        windows = (double) (board.width >= s.width ? board.width - s.width + 1 : 0) *
+                  (board.height >= s.height ? board.height - s.height + 1 : 0);
+        printf("\nFerestre evaluate: %.0lf x %d sabloane de %ux%u in %.3lf s (%.2lf milioane ferestre/s, %s, %d fire)\n",
+               windows, s.count, s.width, s.height, seconds, windows * s.count / max(seconds, 1e-9) / 1e6, engine,
+               PoolThreads());
+        if(work[1] > 0)
+            printf("Cascada: %.2lf%% din produsele pixel cu pixel au fost evitate (%.3lf din %.3lf miliarde)\n",
+                   100.0 * (1 - (double) work[0] / work[1]), work[0] / 1e9, work[1] / 1e9);
+        if(levels > 1 && getenv("TM_PYRAMID_CHECK") != NULL)
+            PyramidCheck(board, sums, s, ps, (*f) + first, (*ct) - first, seconds);
+        if(strcmp(engine, "fft") == 0 && getenv("TM_FFT_CHECK") != NULL)
+            FFTCheck(board, sums, s, ps, (*f) + first, (*ct) - first);
+        FreeTemplates(templates + i);
+    }
+
+    free(templates);
+    FreeIntegral(&sums);
+    free(board.pixel);
 }
 
-void TaskV(char *imagePath, window *f, unsigned int ct) {
+void TaskV(char *imagePath, imageData v, window *f, unsigned int ct) {
     qsort(f, ct, sizeof(window), cmp);
     NonMaxRemoval(&f, &ct);
 
     int i;
     for(i = 0; i < ct; i ++) {
-        PerimeterDraw(imagePath, f[i], f[i].c);
+        PerimeterDraw(&v, f[i], f[i].c);
     }
+    SaveImage(v, imagePath);
 }
 
-int main() {
+uint32_t Xorshift32(uint32_t state[static 1]) {
+    uint32_t x = state[0];
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state[0] = x;
+    return x;
+}
+
+// board 4:3 de aproximativ n pixeli: fundal deschis in trepte, impartit in celule de doua ori mai mari decat cel mai
+// mare sablon; in jumatate din celule, la o pozitie aleatoare, e copiat un sablon (gri pe toate canalele), apoi peste
+// tot board-ul se adauga zgomot de +-16. Cifrele plantate se intorc in truth, cu centrul calculat ca la window
+imageData SyntheticBoard(size_t n, templateSet const *sets, int count, plantedDigit **truth, size_t *planted) {
+    imageData v = {0};
+    uint32_t x = 2463534242u;
+    unsigned int cellW = 1, cellH = 1, left, top, i, j;
+    size_t k, capacity = 16;
+    templateSet const *s;
+    plantedDigit d;
+    int t, value;
+
+    for(t = 0; t < count; t ++) {
+        cellW = max(cellW, 2 * sets[t].width);
+        cellH = max(cellH, 2 * sets[t].height);
+    }
+
+    v.width = (unsigned int) sqrt(n * 4.0 / 3);
+    v.height = (n + v.width - 1) / v.width;
+    FindPadding(&v);
+    v.pixel = malloc(3 * (size_t) v.width * v.height);
+    for(i = 0; i < v.height; i ++) {
+        for(j = 0; j < v.width; j ++) {
+            memset(v.pixel + 3 * ((size_t) i * v.width + j), 176 + (i / 64 + j / 64) % 4 * 16, 3);
+        }
+    }
+
+    (*truth) = malloc(capacity * sizeof(plantedDigit));
+    (*planted) = 0;
+    for(top = 0; top + cellH <= v.height; top += cellH) {
+        for(left = 0; left + cellW <= v.width; left += cellW) {
+            if(Xorshift32(&x) & 1)
+                continue;
+            s = sets + Xorshift32(&x) % count;
+            t = Xorshift32(&x) % (*s).count;
+            d.width = (*s).width;
+            d.height = (*s).height;
+            d.x = left + Xorshift32(&x) % (cellW - d.width + 1);
+            d.y = top + Xorshift32(&x) % (cellH - d.height + 1);
+            for(i = 0; i < d.height; i ++) {
+                for(j = 0; j < d.width; j ++) {
+                    memset(v.pixel + 3 * ((size_t) (d.y + i) * v.width + d.x + j), (*s).pixel[t * (*s).area + i * d.width + j], 3);
+                }
+            }
+            d.x += d.width / 2;
+            d.y += d.height / 2;
+            d.c = (*s).c[t];
+
+            if((*planted) == capacity) {
+                capacity *= 2;
+                (*truth) = realloc((*truth), capacity * sizeof(plantedDigit));
+                PROBE_COUNT(PROBE_REALLOC, 1);
+            }
+            (*truth)[(*planted) ++] = d;
+        }
+    }
+
+    for(k = 0; k < (size_t) v.width * v.height; k ++) {
+        value = v.pixel[3 * k] + (int) (Xorshift32(&x) % 33) - 16;
+        value = min(max(value, 0), 255);
+        memset(v.pixel + 3 * k, value, 3);
+    }
+    return v;
+}
+
+// perechi unu la unu intre detectii si cifrele plantate: aceeasi culoare (deci acelasi sablon) si centrul la cel mult
+// un sfert din sablon pe fiecare axa. f trebuie sortat cu CmpPlace; intoarce numarul de detectii corecte
+unsigned int MatchPlanted(window const *f, unsigned int ct, plantedDigit const *truth, size_t planted) {
+    unsigned char *used = calloc(ct + 1, 1);
+    unsigned int hits = 0, lo, hi, mid, i, dx, dy;
+    plantedDigit d;
+    size_t k;
+
+    for(k = 0; k < planted; k ++) {
+        d = truth[k];
+        dx = max(1, d.width / 4);
+        dy = max(1, d.height / 4);
+        lo = 0;
+        hi = ct;
+        while(lo < hi) {
+            mid = (lo + hi) / 2;
+            if(f[mid].y + dy < d.y)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for(i = lo; i < ct && f[i].y <= d.y + dy; i ++) {
+            if(!used[i] && f[i].x + dx >= d.x && f[i].x <= d.x + dx && f[i].c.red == d.c.red &&
+               f[i].c.green == d.c.green && f[i].c.blue == d.c.blue) {
+                used[i] = 1;
+                hits ++;
+                break;
+            }
+        }
+    }
+
+    free(used);
+    return hits;
+}
+
+void Record(double best[], int s, double start) {
+    best[s] = min(best[s], Now() - start);
+}
+
+void PrintStage(char const *name, double seconds, size_t n, int last) {
+    printf("        {\"stage\": \"%s\", \"seconds\": %.6f, \"ns_per_pixel\": %.3f}%s\n", name, seconds, seconds * 1e9 / n,
+           last ? "" : ",");
+}
+
+// --bench [megapixeli...]: TaskIV si TaskV pe board-uri sintetice cu cifrele din directorul curent, fiecare etapa
+// cronometrata separat (cel mai bun timp din 3 rulari); precizia si recall-ul sunt fata de cifrele plantate. JSON
+void BoardBenchmark(double const *sizes, int count) {
+    char const *name[] = {"Grayscale", "IntegralImage", "TemplateMatching", "qsort", "NonMaxRemoval", "PerimeterDraw"};
+    int stages = sizeof(name) / sizeof(name[0]), k, s, run, i, sets, levels, cascade;
+    double best[sizeof(name) / sizeof(name[0])], t, windows;
+    char const **engine;
+    unsigned int ct = 0, raw = 0, hits, j;
+    uint64_t work[2], skipped[2];
+    pixelRGB c[10];
+    templateSet *templates;
+    plantedDigit *truth;
+    imageData v, w;
+    grayImage board;
+    integralImage sums;
+    window *f = malloc(sizeof(window));
+    size_t n, planted;
+    struct rusage usage;
+
+    MatchOptions(&levels, &cascade);
+    InitialiseColors(c);
+    sets = LoadTemplates(&templates, digitPath, c, 10);
+    engine = malloc(sets * sizeof(char const *));
+
+    printf("{\n  \"threads\": %d,\n  \"pyramid\": %d,\n  \"cascade\": %s,\n  \"threshold\": %.3f,\n  \"boards\": [\n",
+           PoolThreads(), max(levels, 1), cascade ? "true" : "false", MATCH_PS);
+    for(k = 0; k < count; k ++) {
+        v = SyntheticBoard((size_t) (sizes[k] * 1e6), templates, sets, &truth, &planted);
+        n = (size_t) v.width * v.height;
+        w = v;
+        w.pixel = malloc(3 * n);
+        skipped[0] = skipped[1] = 0;
+        for(s = 0; s < stages; s ++) {
+            best[s] = 1e30;
+        }
+
+        // PerimeterDraw deseneaza pe board, asa ca fiecare rulare porneste de la o copie curata
+        for(run = 0; run < 3; run ++) {
+            memcpy(w.pixel, v.pixel, 3 * n);
+            ct = 0;
+            s = 0;
+            t = Now();
+            board = Grayscale(w);
+            Record(best, s ++, t);
+
+            t = Now();
+            sums = IntegralImage(board);
+            Record(best, s ++, t);
+
+            t = Now();
+            for(i = 0; i < sets; i ++) {
+                work[0] = work[1] = 0;
+                engine[i] = TemplateMatching(board, sums, templates[i], MATCH_PS, levels, cascade, work, &ct, &f);
+                skipped[0] += work[0];
+                skipped[1] += work[1];
+            }
+            Record(best, s ++, t);
+            raw = ct;
+
+            t = Now();
+            qsort(f, ct, sizeof(window), cmp);
+            Record(best, s ++, t);
+
+            t = Now();
+            NonMaxRemoval(&f, &ct);
+            Record(best, s ++, t);
+
+            t = Now();
+            for(j = 0; j < ct; j ++) {
+                PerimeterDraw(&w, f[j], f[j].c);
+            }
+            Record(best, s ++, t);
+
+            FreeIntegral(&sums);
+            free(board.pixel);
+        }
+
+        qsort(f, ct, sizeof(window), CmpPlace);
+        hits = MatchPlanted(f, ct, truth, planted);
+        windows = 0;
+        for(i = 0; i < sets; i ++) {
+            windows += (double) (v.width >= templates[i].width ? v.width - templates[i].width + 1 : 0) *
+                       (v.height >= templates[i].height ? v.height - templates[i].height + 1 : 0) * templates[i].count;
+        }
+
+        getrusage(RUSAGE_SELF, &usage);
+        printf("    {\n      \"pixels\": %zu,\n      \"width\": %u,\n      \"height\": %u,\n      \"planted\": %zu,\n",
+               n, v.width, v.height, planted);
+        printf("      \"windows\": %.0f,\n      \"windows_per_s\": %.0f,\n      \"engines\": [", windows,
+               windows / best[2]);
+        for(i = 0; i < sets; i ++) {
+            printf("\"%s\"%s", engine[i], i == sets - 1 ? "" : ", ");
+        }
+        printf("],\n");
+        if(skipped[1] > 0)
+            printf("      \"cascade_skipped\": %.4f,\n", 1 - (double) skipped[0] / skipped[1]);
+        printf("      \"raw_detections\": %u,\n      \"detections\": %u,\n      \"true_positives\": %u,\n", raw, ct, hits);
+        printf("      \"precision\": %.4f,\n      \"recall\": %.4f,\n      \"peak_rss_kb\": %ld,\n      \"stages\": [\n",
+               ct > 0 ? (double) hits / ct : 1.0, planted > 0 ? (double) hits / planted : 1.0, usage.ru_maxrss);
+        for(s = 0; s < stages; s ++) {
+            PrintStage(name[s], best[s], n, s == stages - 1);
+        }
+        printf("      ]\n    }%s\n", k == count - 1 ? "" : ",");
+        fflush(stdout);
+
+        free(truth);
+        free(w.pixel);
+        free(v.pixel);
+    }
+    printf("  ]\n}\n");
+
+    for(i = 0; i < sets; i ++) {
+        FreeTemplates(templates + i);
+    }
+    free(templates);
+    free(engine);
+    free(f);
+}
+
+int main(int argc, char *argv[]) {
     char imagePath[101];
     unsigned int ct = 0;
-    window *f = malloc(sizeof(window));
+    window *f;
+    imageData v;
+    double sizes[16] = {1, 10, 50};
+    int i, benchSizes = 0;
+    char *end;
+    char const *timer[] = {"TemplateMatching", "ImageSlide", "ImageSlideFFT", "NonMaxRemoval", "PerimeterDraw", NULL};
+    char const *counter[] = {"windows_evaluated", "windows_over_threshold", "nms_comparisons", NULL};
+
+    PROBE_INIT("template-matching", timer, counter);
+    for(i = 1; i < argc; i ++) {
+        // --bench [megapixeli...]: etapele pe board-uri sintetice, in JSON; implicit 1, 10 si 50 MP
+        if(strcmp(argv[i], "--bench") == 0) {
+            while(i + 1 < argc && benchSizes < 16 && (sizes[benchSizes] = strtod(argv[i + 1], &end)) > 0 && *end == '\0') {
+                benchSizes ++;
+                i ++;
+            }
+            BoardBenchmark(sizes, benchSizes > 0 ? benchSizes : 3);
+            return 0;
+        }
+    }
 
-    TaskIV(imagePath, &f, &ct);
-    TaskV(imagePath, f, ct);
+    f = malloc(sizeof(window));
+    TaskIV(imagePath, &v, &f, &ct);
+    TaskV(imagePath, v, f, ct);
 
+    free(v.pixel);
     free(f);
     return 0;
 }
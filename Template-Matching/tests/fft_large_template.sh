@@ -0,0 +1,41 @@
+#!/bin/sh
+# motorul FFT da aceleasi detectii si scoruri ca CrossCorrelation pe un sablon mai mare de DIRECT_MAX_AREA pixeli
+# (300x300, taiat dintr-o tabla cu valori 200-255, unde suma patratelor unei ferestre nu incape in 32 de biti)
+# rulare: tests/fft_large_template.sh [template-matching], din Template-Matching/; cere python3
+set -e
+bin=$(cd "$(dirname "${1:-./template-matching}")" && pwd)/$(basename "${1:-./template-matching}")
+input=$(cd "$(dirname "$0")/../input" && pwd)
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+cp "$input"/cifra*.bmp .
+python3 - <<'PY'
+import random, struct
+
+def save(path, width, height, pixel):
+    padding = (4 - 3 * width % 4) % 4
+    size = 54 + (3 * width + padding) * height
+    header = b"BM" + struct.pack("<IHHIIiiHHIIiiII", size, 0, 0, 54, 40, width, height, 1, 24, 0,
+                                 size - 54, 2835, 2835, 0, 0)
+    rows = [bytes(pixel[i * 3 * width:(i + 1) * 3 * width]) + b"\0" * padding for i in range(height)]
+    open(path, "wb").write(header + b"".join(reversed(rows)))
+
+random.seed(7)
+width, height = 380, 340
+board = [random.randint(200, 255) for i in range(3 * width * height)]
+save("board.bmp", width, height, board)
+template = []
+for i in range(300):
+    template += board[3 * ((20 + i) * width + 40):3 * ((20 + i) * width + 340)]
+save("cifra0.bmp", 300, 300, template)
+PY
+
+printf 'board.bmp\n' | TM_FFT_CHECK=1 "$bin" > out.txt
+line=$(grep "^FFT:" out.txt) || { echo "FAIL: the 300x300 template did not use the FFT engine"; cat out.txt; exit 1; }
+set -- $line
+# FFT: <gasite> din <directe> detectii directe, <fft> ferestre peste prag prin FFT; diferenta maxima ... <d>
+[ "$2" -gt 0 ] && [ "$2" = "$4" ] && [ "$2" = "$7" ] ||
+    { echo "FAIL: FFT and direct detections differ: $line"; exit 1; }
+awk -v d="${line##* }" 'BEGIN { exit !(d + 0 < 1e-9) }' || { echo "FAIL: scores differ: $line"; exit 1; }
+echo "fft_large_template: ok"